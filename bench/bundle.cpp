@@ -0,0 +1,93 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include "MathParser.hpp"
+#include "MathBundle.hpp"
+
+// Throughput of a family of E formulas over the same N points: one pass per
+// formula versus a single pass of an expression bundle. Run with
+// `make bench-bundle [E=...] [N=...]`.
+int main(int argc, char *argv[])
+{
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 100;
+    const size_t points = argc > 2 ? std::stoul(argv[2]) : 1 << 20;
+    // model variants sharing sin(x), x^2, exp-like and rational terms
+    const char *shapes[] = {"%d*sin(x)+%d*x^2-%d", "sin(x)*cos(x)+x^2/%d+%d-%d", "sqrt(abs(x))*%d+sin(x)/(%d+x^2)-%d",
+                            "(x^2+%d)/(x^2+%d)+tanh(x/%d)", "%d*x^3+sin(x)*x^2+%d*cos(x)-%d"};
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < count; ++i)
+    {
+        char buffer[128];
+        std::snprintf(buffer, sizeof(buffer), shapes[i % 5], int(i % 7 + 1), int(i % 11 + 2), int(i % 13 + 1));
+        sources.push_back(buffer);
+    }
+    std::vector<double> x(points);
+    for (size_t i = 0; i < points; ++i)
+    {
+        x[i] = -8.0 + 16.0 * i / points;
+    }
+    const double *inputs[] = {x.data()};
+    std::vector<std::vector<double>> separate(count, std::vector<double>(points));
+    std::vector<std::vector<double>> optimized(count, std::vector<double>(points));
+    std::vector<std::vector<double>> fused(count, std::vector<double>(points));
+    std::vector<double *> outs;
+    for (auto &column : fused)
+    {
+        outs.push_back(column.data());
+    }
+
+    using clock = std::chrono::steady_clock;
+    std::vector<MathParser> parsers(sources.begin(), sources.end());
+    auto start = clock::now();
+    for (size_t e = 0; e < count; ++e)
+    {
+        MathParser::evaluateBatch(parsers[e].compiled(), inputs, separate[e].data(), points);
+    }
+    const double one_at_a_time = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::vector<moptimize::RegisterProgram> programs;
+    for (auto &p : parsers)
+    {
+        programs.push_back(moptimize::optimize(p.compiled().code, p.compiled().length));
+    }
+    start = clock::now();
+    for (size_t e = 0; e < count; ++e)
+    {
+        double *out = optimized[e].data();
+        programs[e].evaluateBatch(inputs, &out, points);
+    }
+    const double optimized_one_at_a_time = std::chrono::duration<double>(clock::now() - start).count();
+
+    start = clock::now();
+    const mbundle::ExpressionBundle bundle(sources);
+    const double compile = std::chrono::duration<double>(clock::now() - start).count();
+    start = clock::now();
+    bundle.evaluate(inputs, outs.data(), points);
+    const double bundled = std::chrono::duration<double>(clock::now() - start).count();
+
+    const mbundle::ExpressionBundle::Stats stats = bundle.stats();
+    const double evaluations = double(count) * points;
+    std::cout << "[*] formulas x points:        " << count << " x " << points << "\n"
+              << "[*] instructions -> ops:      " << stats.instructions << " -> " << stats.ops << " (+"
+              << stats.constants << " constants, " << stats.registers << " registers)\n"
+              << "[*] one at a time:            " << one_at_a_time * 1e3 << " ms, " << evaluations / one_at_a_time / 1e6
+              << " M evals/s\n"
+              << "[*] optimized, one at a time: " << optimized_one_at_a_time * 1e3 << " ms, "
+              << evaluations / optimized_one_at_a_time / 1e6 << " M evals/s\n"
+              << "[*] bundle:                   " << bundled * 1e3 << " ms, " << evaluations / bundled / 1e6
+              << " M evals/s (x" << one_at_a_time / bundled << ", compiled in " << compile * 1e3 << " ms)\n";
+    for (size_t e = 0; e < count; ++e)
+    {
+        if (std::memcmp(separate[e].data(), fused[e].data(), points * sizeof(double)) != 0 ||
+            std::memcmp(separate[e].data(), optimized[e].data(), points * sizeof(double)) != 0)
+        {
+            std::cout << "[X] results differ for " << sources[e] << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+// ahead of <random>, which pulls in <cmath>: MathParser.hpp defines M_PI itself
+#include "MathParser.hpp"
+#include "MathParserCache.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+
+// Lookup cost of the expression cache against parsing, and a fuzz of N random
+// expressions checking that the cache key of each one compiles to the very
+// same program as the text itself. Run with `make bench-cache [N=...]`.
+namespace
+{
+    std::mt19937 rng(42);
+
+    size_t pick(size_t n)
+    {
+        return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+    }
+
+    std::string space()
+    {
+        return pick(4) == 0 ? " " : "";
+    }
+
+    // Random expression with bare function calls ("sin x"), unary minus,
+    // redundant parentheses and stray spaces.
+    std::string expression(int depth)
+    {
+        static const char *atoms[] = {"x", "y", "a", "2", "1.5", "3"};
+        static const char *functions[] = {"sin", "ln", "sqrt", "abs"};
+        static const char ops[] = {'+', '-', '*', '/', '^'};
+        std::string e;
+        switch (depth <= 0 ? pick(2) : pick(6))
+        {
+        case 0:
+        case 1:
+            e = atoms[pick(6)];
+            break;
+        case 2:
+            e = std::string(functions[pick(4)]) + (pick(2) ? "(" + expression(depth - 1) + ")" : " " + std::string(atoms[pick(6)]));
+            break;
+        case 3:
+            e = "-" + expression(depth - 1);
+            break;
+        default:
+            e = expression(depth - 1) + space() + ops[pick(5)] + space() + expression(depth - 1);
+            break;
+        }
+        return pick(3) == 0 ? "(" + space() + e + space() + ")" : e;
+    }
+
+    bool sameProgram(const MathParser &a, const MathParser &b)
+    {
+        const MathParser::CompiledView x = a.compiled(), y = b.compiled();
+        if (x.length != y.length || x.slot_count != y.slot_count ||
+            std::memcmp(x.slots, y.slots, x.slot_count) != 0)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < x.length; ++i)
+        {
+            if (x.code[i].op != y.code[i].op || x.code[i].slot != y.code[i].slot ||
+                std::memcmp(&x.code[i].value, &y.code[i].value, sizeof(double)) != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 20000;
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < count; ++i)
+    {
+        sources.push_back(expression(4));
+    }
+
+    size_t mismatches = 0, malformed = 0;
+    for (auto &raw : sources)
+    {
+        const std::string key = mcache::normalize(raw);
+        try
+        {
+            const MathParser text(raw);
+            if (!sameProgram(text, MathParser(key)))
+            {
+                if (mismatches++ < 5)
+                {
+                    std::cout << "[X] \"" << raw << "\" -> key \"" << key << "\" compiles differently\n";
+                }
+            }
+        }
+        catch (const std::invalid_argument &)
+        {
+            ++malformed;
+        }
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    for (auto &raw : sources)
+    {
+        try
+        {
+            MathParser p(raw);
+        }
+        catch (const std::invalid_argument &)
+        {
+        }
+    }
+    const double parse = std::chrono::duration<double>(clock::now() - start).count();
+    mcache::ExpressionCache cache(count);
+    for (auto &raw : sources)
+    {
+        try
+        {
+            cache.get(raw);
+        }
+        catch (const std::invalid_argument &)
+        {
+        }
+    }
+    start = clock::now();
+    for (auto &raw : sources)
+    {
+        try
+        {
+            cache.get(raw);
+        }
+        catch (const std::invalid_argument &)
+        {
+        }
+    }
+    const double hit = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::cout << "[*] expressions:  " << count << " (" << malformed << " malformed)\n"
+              << "[*] parse:        " << parse * 1e3 << " ms\n"
+              << "[*] cache hits:   " << hit * 1e3 << " ms (x" << parse / hit << ")\n";
+    if (mismatches > 0)
+    {
+        std::cout << "[X] " << mismatches << " keys compile differently from their text" << std::endl;
+        return 1;
+    }
+    return 0;
+}
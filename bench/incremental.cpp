@@ -0,0 +1,79 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+
+#include "MathParser.hpp"
+#include "MathIncremental.hpp"
+
+// Sweep of x over N points for formulas with many fixed parameters:
+// evaluateFunction with the whole variable map versus an incremental
+// evaluator updating x alone. Every value must be bitwise identical, signed
+// zeros and changes of several variables at once included. Run with
+// `make bench-incremental [N=...]`.
+int main(int argc, char *argv[])
+{
+    const size_t points = argc > 1 ? std::stoul(argv[1]) : 1 << 18;
+    const std::vector<std::string> sources = {
+        "1/x+a*b", "2 3",
+        "sin(a*b+c)*cos(d/e)+sqrt(abs(f-g))*x^2+tanh(h*i)/(j+1)-ln(k+2)*x",
+        "(a+b+c+d+e+f)^2/(1+x^2)+atan(g*h)*sin(x/i)-(j*k)/(x-1)"};
+    std::vector<double> xs = {0.0, -0.0, 1.0, -0.0, 0.0, INFINITY, -INFINITY, NAN, 1.0};
+    for (size_t i = 0; xs.size() < points; ++i)
+    {
+        xs.push_back(-5.0 + 10.0 * i / points);
+    }
+
+    using clock = std::chrono::steady_clock;
+    double full = 0, incremental = 0;
+    for (auto &source : sources)
+    {
+        const MathParser p(source);
+        std::map<std::string, double> vars;
+        for (char v : p.variables())
+        {
+            vars[std::string{v}] = 0.5 + 0.125 * (v - 'a');
+        }
+        mincremental::IncrementalEvaluator inc(p);
+        inc.set(vars);
+
+        std::vector<double> expected(xs.size()), got(xs.size());
+        auto start = clock::now();
+        for (size_t i = 0; i < xs.size(); ++i)
+        {
+            vars["x"] = xs[i];
+            expected[i] = p.evaluateFunction(vars);
+        }
+        full += std::chrono::duration<double>(clock::now() - start).count();
+        start = clock::now();
+        for (size_t i = 0; i < xs.size(); ++i)
+        {
+            inc.set('x', xs[i]);
+            got[i] = inc.value();
+        }
+        incremental += std::chrono::duration<double>(clock::now() - start).count();
+
+        // several variables changing together take the other recompute path
+        for (size_t i = 0; i < 1024 && i < xs.size(); ++i)
+        {
+            for (auto &[name, value] : vars)
+            {
+                value = name == "x" ? xs[i] : value + 0.25;
+            }
+            inc.set(vars);
+            expected.push_back(p.evaluateFunction(vars));
+            got.push_back(inc.value());
+        }
+        if (std::memcmp(expected.data(), got.data(), expected.size() * sizeof(double)) != 0)
+        {
+            std::cout << "[X] results differ for " << source << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "[*] formulas x points: " << sources.size() << " x " << xs.size() << "\n"
+              << "[*] evaluateFunction:  " << full * 1e3 << " ms\n"
+              << "[*] incremental:       " << incremental * 1e3 << " ms (x" << full / incremental << ")\n";
+    return 0;
+}
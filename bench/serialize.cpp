@@ -0,0 +1,63 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "MathParser.hpp"
+#include "MathSerialize.hpp"
+
+// Startup cost of N formulas: parsing the text of each one versus mapping a
+// compiled expression library. Run with `make bench-serialize [N=...]`.
+int main(int argc, char *argv[])
+{
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 20000;
+    const std::string path = "build/bench_library.mpx";
+    const char *shapes[] = {"%d*x^2+%d*x-%d", "sin(x/%d)*cos(x*%d)+ln(x+%d)", "sqrt(abs(x-%d))/(%d+x)^%d",
+                            "(x+%d)*(x-%d)*(x+%d)*(x-1)*(x+2)", "tanh(%d*x)+atan(x/%d)-%d^x"};
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < count; ++i)
+    {
+        char buffer[128];
+        std::snprintf(buffer, sizeof(buffer), shapes[i % 5], int(i % 7 + 1), int(i % 11 + 2), int(i % 3 + 1));
+        sources.push_back(buffer);
+    }
+    mserial::writeLibrary(path, sources);
+
+    using clock = std::chrono::steady_clock;
+    double checksum_text = 0;
+    auto start = clock::now();
+    std::vector<MathParser> parsed;
+    parsed.reserve(count);
+    for (auto &s : sources)
+    {
+        parsed.emplace_back(s);
+    }
+    for (auto &p : parsed)
+    {
+        const double x = 0.5;
+        checksum_text += p.evaluateCompiled(p.compiled(), &x);
+    }
+    const double text = std::chrono::duration<double>(clock::now() - start).count();
+
+    double checksum_library = 0;
+    start = clock::now();
+    mserial::Library library(path);
+    for (size_t i = 0; i < library.size(); ++i)
+    {
+        const double x = 0.5;
+        checksum_library += MathParser::evaluateCompiled(library[i], &x);
+    }
+    const double mapped = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::cout << "[*] formulas:          " << count << "\n"
+              << "[*] text parse + eval: " << text * 1e3 << " ms\n"
+              << "[*] library map + eval: " << mapped * 1e3 << " ms (x" << text / mapped << ")\n";
+    if (checksum_text != checksum_library)
+    {
+        std::cout << "[X] results differ: " << checksum_text << " vs " << checksum_library << std::endl;
+        return 1;
+    }
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,245 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <functional>
+
+#include "MathParser.hpp"
+#include "MathFunctionGraphConsole.hpp"
+
+// Microbenchmarks of MathParser and mfgc::graph. Every metric is a time
+// (lower is better) reported as flat JSON; with --compare the run fails when
+// a metric is slower than the baseline by more than --threshold percent.
+// Automatic promotion is off, so the evaluate* metrics always time the
+// interpreter tier and the promoted.* ones the tiers promote() installs.
+//
+//   bench-suite [--out FILE] [--compare BASELINE] [--threshold PERCENT]
+
+namespace
+{
+    volatile double sink;
+
+    // Best of five trials of the average time per call in nanoseconds, each
+    // trial repeating fn for at least 20 ms.
+    double measure(const std::function<void()> &fn)
+    {
+        using clock = std::chrono::steady_clock;
+        size_t reps = 1;
+        double best = 1e300;
+        for (int trial = 0; trial < 5;)
+        {
+            auto start = clock::now();
+            for (size_t i = 0; i < reps; ++i)
+            {
+                fn();
+            }
+            const double elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+            if (elapsed < 2e7)
+            {
+                reps *= 2;
+                continue;
+            }
+            best = std::min(best, elapsed / reps);
+            ++trial;
+        }
+        return best;
+    }
+
+    std::string deep(int levels)
+    {
+        std::string e = "x";
+        for (int i = 1; i <= levels; ++i)
+        {
+            e = "(" + e + "+" + std::to_string(i) + ")*x";
+        }
+        return e;
+    }
+
+    struct Case
+    {
+        std::string name;
+        std::string fx;       // in x, for evaluateFunctionInX and evaluateFunction
+        std::string constant; // the same shape without variables, for evaluate
+    };
+
+    std::map<std::string, double> run()
+    {
+        const std::vector<Case> corpus = {
+            {"trivial", "x", "2"},
+            {"poly", "x^2+3*x-1", "2^2+3*2-1"},
+            {"trig", "sin(x)*cos(x)+ln(x+2)", "sin(2)*cos(2)+ln(2+2)"},
+            {"nested", "sqrt(abs(sin(x)/(1+x^2)))^3", "sqrt(abs(sin(2)/(1+2^2)))^3"},
+            {"deep", deep(32), ""}};
+        mtier::policy().optimize_after = UINT64_MAX;
+        mtier::policy().vectorize_after = UINT64_MAX;
+        std::map<std::string, double> metrics;
+        for (auto &c : corpus)
+        {
+            metrics["parse." + c.name + "_ns"] = measure([&]
+                                                         { MathParser p(c.fx);
+                                                           sink = p.variables().size(); });
+            const MathParser p(c.fx);
+            const MathParser k(c.constant.empty() ? "0" : c.constant);
+            double x = 0.5;
+            const std::map<std::string, double> vars = {{"x", x}};
+            std::vector<double> xs(4096, x), out(4096);
+            const double *inputs[] = {xs.data()};
+            for (const std::string prefix : {"", "promoted."})
+            {
+                metrics[prefix + "evaluateFunctionInX." + c.name + "_ns"] = measure([&]
+                                                                                    { sink = p.evaluateFunctionInX(x); });
+                metrics[prefix + "evaluateFunction." + c.name + "_ns"] = measure([&]
+                                                                                 { sink = p.evaluateFunction(vars); });
+                metrics[prefix + "evaluateBatch." + c.name + "_ns_per_point"] = measure([&]
+                                                                                        { p.evaluateBatch(inputs, out.data(), out.size()); }) /
+                                                                                out.size();
+                if (!c.constant.empty())
+                {
+                    metrics[prefix + "evaluate." + c.name + "_ns"] = measure([&]
+                                                                             { sink = k.evaluate(); });
+                }
+                for (const MathParser *e : {&p, &k})
+                {
+                    e->promote(mtier::Tier::Optimized);
+                    e->promote(mtier::Tier::Vectorized);
+                }
+            }
+        }
+        const MathParser integrand("sin(x)*x^2");
+        for (size_t n : {1000, 10000, 100000})
+        {
+            metrics["integrate.n" + std::to_string(n) + "_ns"] = measure([&]
+                                                                         { sink = integrand.integrate(0, 3, n); });
+        }
+        // graph writes to cout: time it against a discarding buffer
+        std::stringbuf discard;
+        std::streambuf *console = std::cout.rdbuf(&discard);
+        const MathParser curve("x^3/10-x");
+        for (int width : {25, 51, 101})
+        {
+            metrics["graph.w" + std::to_string(width) + "_ns"] = measure([&]
+                                                                         {
+                VectorState *arr = mfgc::graph(width, 0.5, [&](double x)
+                                               { return curve.evaluateFunctionInX(x); });
+                delete[] arr;
+                discard.str(""); });
+        }
+        std::cout.rdbuf(console);
+        return metrics;
+    }
+
+    void write(std::ostream &os, const std::map<std::string, double> &metrics)
+    {
+        os << "{\n";
+        for (auto it = metrics.begin(); it != metrics.end(); ++it)
+        {
+            os << "  \"" << it->first << "\": " << it->second << (std::next(it) != metrics.end() ? ",\n" : "\n");
+        }
+        os << "}\n";
+    }
+
+    // Reads the flat {"name": number, ...} files written by write().
+    std::map<std::string, double> read(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            throw std::runtime_error("cannot open " + path);
+        }
+        std::stringstream text;
+        text << in.rdbuf();
+        const std::string s = text.str();
+        std::map<std::string, double> metrics;
+        for (size_t at = s.find('"'); at != std::string::npos; at = s.find('"', at))
+        {
+            const size_t end = s.find('"', at + 1);
+            const size_t colon = s.find(':', end);
+            if (end == std::string::npos || colon == std::string::npos)
+            {
+                break;
+            }
+            metrics[s.substr(at + 1, end - at - 1)] = std::stod(s.substr(colon + 1));
+            at = colon;
+        }
+        return metrics;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string out_path, baseline_path;
+    double threshold = 10;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--out" && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if (arg == "--compare" && i + 1 < argc)
+        {
+            baseline_path = argv[++i];
+        }
+        else if (arg == "--threshold" && i + 1 < argc)
+        {
+            threshold = std::stod(argv[++i]);
+        }
+        else
+        {
+            std::cerr << "usage: bench-suite [--out FILE] [--compare BASELINE] [--threshold PERCENT]\n";
+            return 2;
+        }
+    }
+    std::map<std::string, double> baseline;
+    if (!baseline_path.empty())
+    {
+        try
+        {
+            baseline = read(baseline_path);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[X] " << e.what() << ": record one first with `make bench-baseline`\n";
+            return 2;
+        }
+    }
+
+    const std::map<std::string, double> metrics = run();
+    write(std::cout, metrics);
+    if (!out_path.empty())
+    {
+        std::ofstream out(out_path);
+        write(out, metrics);
+    }
+    if (baseline_path.empty())
+    {
+        return 0;
+    }
+
+    int regressions = 0;
+    for (auto &[name, value] : metrics)
+    {
+        auto it = baseline.find(name);
+        if (it == baseline.end())
+        {
+            continue;
+        }
+        const double change = (value / it->second - 1) * 100;
+        if (change > threshold)
+        {
+            std::cerr << "[X] " << name << ": " << it->second << " -> " << value << " (+" << change << "%)\n";
+            ++regressions;
+        }
+    }
+    if (regressions > 0)
+    {
+        std::cerr << "[X] " << regressions << " metrics regressed more than " << threshold << "%\n";
+        return 1;
+    }
+    std::cerr << "[*] no metric regressed more than " << threshold << "%\n";
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+
+#include "MathParser.hpp"
+
+// Scalar and batch evaluation of a few formulas in the interpreter tier and
+// once promoted: every tier must return bitwise identical doubles. Run with
+// `make bench-tiers [N=...]`.
+int main(int argc, char *argv[])
+{
+    const size_t points = argc > 1 ? std::stoul(argv[1]) : 1 << 16;
+    const std::vector<std::string> sources = {"sqrt(4)+1", "2*-3", "x+1", "-x", "sin(x)*cos(x)+ln(x+2)",
+                                              "sqrt(abs(sin(x)/(1+x^2)))^3", "tanh(x)/(x+a)-asin(x/9)*b",
+                                              "x^2+3*x-1", "foo(x)*2"};
+    // promotions only happen through promote() below
+    mtier::policy().optimize_after = UINT64_MAX;
+    mtier::policy().vectorize_after = UINT64_MAX;
+
+    std::vector<double> xs(points);
+    for (size_t i = 0; i < points; ++i)
+    {
+        xs[i] = -10.0 + 20.0 * i / points;
+    }
+    // scalar calls of evaluate, evaluateFunctionInX and evaluateFunction,
+    // then the batch results
+    auto run = [&](const MathParser &p, std::vector<double> &out)
+    {
+        out.clear();
+        out.push_back(p.evaluate());
+        std::map<std::string, double> vars;
+        for (char v : p.variables())
+        {
+            vars[std::string{v}] = 0.25 * (v - 'a');
+        }
+        for (double x : xs)
+        {
+            out.push_back(p.evaluateFunctionInX(x));
+            if (vars.count("x"))
+            {
+                vars["x"] = x;
+            }
+            out.push_back(p.evaluateFunction(vars));
+        }
+        std::vector<std::vector<double>> columns(p.variables().size(), xs);
+        std::vector<const double *> inputs;
+        for (auto &c : columns)
+        {
+            inputs.push_back(c.data());
+        }
+        out.resize(out.size() + points);
+        p.evaluateBatch(inputs.data(), out.data() + out.size() - points, points);
+    };
+
+    using clock = std::chrono::steady_clock;
+    double interpreted = 0, promoted = 0;
+    for (auto &source : sources)
+    {
+        const MathParser p(source);
+        std::vector<double> before, after;
+        auto start = clock::now();
+        run(p, before);
+        interpreted += std::chrono::duration<double>(clock::now() - start).count();
+        p.promote(mtier::Tier::Optimized);
+        p.promote(mtier::Tier::Vectorized);
+        start = clock::now();
+        run(p, after);
+        promoted += std::chrono::duration<double>(clock::now() - start).count();
+        const mtier::Stats stats = p.tierStats();
+        if (stats.scalar_tier != mtier::Tier::Optimized || stats.batch_tier != mtier::Tier::Vectorized ||
+            std::memcmp(before.data(), after.data(), before.size() * sizeof(double)) != 0)
+        {
+            std::cout << "[X] tiers differ for " << source << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "[*] formulas x points: " << sources.size() << " x " << points << "\n"
+              << "[*] interpreter tier:  " << interpreted * 1e3 << " ms\n"
+              << "[*] promoted tiers:    " << promoted * 1e3 << " ms (x" << interpreted / promoted << ")\n";
+    return 0;
+}
@@ -0,0 +1,501 @@
+#ifndef MATH_BATCH_H
+#define MATH_BATCH_H
+
+// ahead of <cmath>: MathParser.hpp defines M_PI itself
+#include "MathBundle.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+
+// Non-interactive evaluation: expressions are applied to every row of a CSV
+// (or newline-delimited) input and the results are streamed out as CSV.
+// Reading, evaluating and writing run on three threads connected by bounded
+// queues of Chunk, so parsing the next rows overlaps with evaluating and
+// formatting the previous ones.
+namespace mbatch
+{
+    // Rows per chunk: one pass of the expression bundle per chunk.
+    constexpr size_t ChunkRows = 4096;
+    // Chunks in flight between two stages.
+    constexpr size_t QueueDepth = 4;
+    constexpr size_t IoBufferSize = 1 << 20;
+
+    struct Options
+    {
+        std::vector<std::string> expressions;
+        std::string input = "-";
+        std::string output = "-";
+        char delimiter = ',';
+        bool header = false;
+    };
+
+    struct Chunk
+    {
+        size_t rows = 0;
+        std::vector<std::vector<double>> columns; // one per input column
+        std::vector<std::vector<double>> results; // one per expression
+    };
+
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+        void push(T value)
+        {
+            std::unique_lock lock(mutex);
+            not_full.wait(lock, [&]
+                          { return items.size() < capacity; });
+            items.push_back(std::move(value));
+            not_empty.notify_one();
+        }
+        // Returns false once the queue is closed and drained.
+        bool pop(T &value)
+        {
+            std::unique_lock lock(mutex);
+            not_empty.wait(lock, [&]
+                           { return !items.empty() || closed; });
+            if (items.empty())
+            {
+                return false;
+            }
+            value = std::move(items.front());
+            items.pop_front();
+            not_full.notify_one();
+            return true;
+        }
+        void close()
+        {
+            std::lock_guard lock(mutex);
+            closed = true;
+            not_empty.notify_all();
+        }
+
+    private:
+        size_t capacity;
+        std::deque<T> items;
+        bool closed = false;
+        std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+    };
+
+    // Line reader over a FILE* with a large buffer; the returned view is valid
+    // until the next call.
+    class LineReader
+    {
+    public:
+        explicit LineReader(FILE *file) : file(file), buffer(IoBufferSize) {}
+        bool next(std::string_view &line)
+        {
+            while (true)
+            {
+                const char *begin = buffer.data() + pos;
+                const char *nl = (const char *)std::memchr(begin, '\n', len - pos);
+                if (nl != nullptr)
+                {
+                    line = trimEol(std::string_view(begin, nl - begin));
+                    pos = nl - buffer.data() + 1;
+                    return true;
+                }
+                if (eof)
+                {
+                    if (pos == len)
+                    {
+                        return false;
+                    }
+                    line = trimEol(std::string_view(begin, len - pos));
+                    pos = len;
+                    return true;
+                }
+                // keep the partial line and refill behind it
+                std::memmove(buffer.data(), begin, len - pos);
+                len -= pos;
+                pos = 0;
+                if (len == buffer.size())
+                {
+                    buffer.resize(buffer.size() * 2);
+                }
+                const size_t got = std::fread(buffer.data() + len, 1, buffer.size() - len, file);
+                len += got;
+                eof = got == 0;
+            }
+        }
+
+    private:
+        static std::string_view trimEol(std::string_view s)
+        {
+            return !s.empty() && s.back() == '\r' ? s.substr(0, s.size() - 1) : s;
+        }
+        FILE *file;
+        std::vector<char> buffer;
+        size_t pos = 0;
+        size_t len = 0;
+        bool eof = false;
+    };
+
+    inline std::string_view trim(std::string_view s)
+    {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        {
+            s.remove_prefix(1);
+        }
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        {
+            s.remove_suffix(1);
+        }
+        return s;
+    }
+
+    // Locale independent; '+' prefixes are accepted, anything else non-numeric fails.
+    inline bool parseNumber(std::string_view s, double &value)
+    {
+        s = trim(s);
+        if (!s.empty() && s.front() == '+')
+        {
+            s.remove_prefix(1);
+        }
+        auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+        return ec == std::errc() && end == s.data() + s.size() && !s.empty();
+    }
+
+    inline void splitFields(std::string_view line, char delimiter, std::vector<std::string_view> &fields)
+    {
+        fields.clear();
+        size_t start = 0;
+        while (true)
+        {
+            size_t end = line.find(delimiter, start);
+            if (end == std::string_view::npos)
+            {
+                fields.push_back(line.substr(start));
+                return;
+            }
+            fields.push_back(line.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    class Writer
+    {
+    public:
+        explicit Writer(FILE *file) : file(file)
+        {
+            buffer.reserve(IoBufferSize + 64);
+        }
+        ~Writer()
+        {
+            flush();
+        }
+        void number(double v)
+        {
+            char tmp[32];
+            auto [end, ec] = std::to_chars(tmp, tmp + sizeof(tmp), v);
+            buffer.insert(buffer.end(), tmp, end);
+        }
+        void text(std::string_view s)
+        {
+            buffer.insert(buffer.end(), s.begin(), s.end());
+        }
+        void put(char c)
+        {
+            buffer.push_back(c);
+            if (buffer.size() >= IoBufferSize)
+            {
+                flush();
+            }
+        }
+        void flush()
+        {
+            std::fwrite(buffer.data(), 1, buffer.size(), file);
+            buffer.clear();
+        }
+
+    private:
+        FILE *file;
+        std::vector<char> buffer;
+    };
+
+    inline std::vector<std::string> readExpressions(const std::string &path)
+    {
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr)
+        {
+            throw std::runtime_error("cannot open " + path);
+        }
+        std::vector<std::string> expressions;
+        LineReader reader(file);
+        std::string_view line;
+        while (reader.next(line))
+        {
+            line = trim(line);
+            if (!line.empty())
+            {
+                expressions.emplace_back(line);
+            }
+        }
+        std::fclose(file);
+        return expressions;
+    }
+
+    // Streams opt.input through every expression into opt.output and returns
+    // the number of rows evaluated. Without a header the input columns bind
+    // the variables of all expressions in alphabetical order.
+    inline size_t run(const Options &opt)
+    {
+        if (opt.expressions.empty())
+        {
+            throw std::runtime_error("no expression given");
+        }
+        const mbundle::ExpressionBundle bundle(opt.expressions);
+        const std::vector<char> &used = bundle.variables();
+
+        FILE *in = opt.input == "-" ? stdin : std::fopen(opt.input.c_str(), "rb");
+        if (in == nullptr)
+        {
+            throw std::runtime_error("cannot open " + opt.input);
+        }
+        FILE *out = opt.output == "-" ? stdout : std::fopen(opt.output.c_str(), "wb");
+        if (out == nullptr)
+        {
+            throw std::runtime_error("cannot create " + opt.output);
+        }
+
+        // The first line decides the column names: a header if any field is
+        // not a number, otherwise the first data row.
+        LineReader reader(in);
+        std::vector<std::string_view> fields;
+        std::string_view line;
+        std::vector<std::string> names;
+        bool pending = false;
+        bool empty = true;
+        while (reader.next(line))
+        {
+            if (trim(line).empty())
+            {
+                continue;
+            }
+            empty = false;
+            splitFields(line, opt.delimiter, fields);
+            double v;
+            bool numeric = true;
+            for (auto &f : fields)
+            {
+                numeric = numeric && parseNumber(f, v);
+            }
+            if (numeric)
+            {
+                auto it = used.begin();
+                for (size_t i = 0; i < fields.size(); ++i)
+                {
+                    names.push_back(it != used.end() ? std::string{*it++} : std::string());
+                }
+                pending = true;
+            }
+            else
+            {
+                for (auto &f : fields)
+                {
+                    names.emplace_back(trim(f));
+                }
+            }
+            break;
+        }
+        // bindings[slot] = input column feeding that variable of the bundle;
+        // an empty input has no columns and no rows to bind them to
+        std::vector<size_t> bindings;
+        for (char var : empty ? std::vector<char>() : used)
+        {
+            auto it = std::find(names.begin(), names.end(), std::string{var});
+            if (it == names.end())
+            {
+                throw std::runtime_error(std::string("no input column for variable ") + var);
+            }
+            bindings.push_back(it - names.begin());
+        }
+        const size_t ncols = names.size();
+
+        BoundedQueue<std::unique_ptr<Chunk>> parsed(QueueDepth);
+        BoundedQueue<std::unique_ptr<Chunk>> evaluated(QueueDepth);
+        size_t total_rows = 0;
+
+        std::thread evaluator([&]()
+                              {
+            std::unique_ptr<Chunk> chunk;
+            std::vector<const double *> inputs;
+            std::vector<double *> outs;
+            while (parsed.pop(chunk))
+            {
+                inputs.clear();
+                for (size_t c : bindings)
+                {
+                    inputs.push_back(chunk->columns[c].data());
+                }
+                chunk->results.resize(bundle.size());
+                outs.clear();
+                for (auto &result : chunk->results)
+                {
+                    result.resize(chunk->rows);
+                    outs.push_back(result.data());
+                }
+                bundle.evaluate(inputs.data(), outs.data(), chunk->rows);
+                evaluated.push(std::move(chunk));
+            }
+            evaluated.close(); });
+
+        std::thread writer([&]()
+                           {
+            Writer w(out);
+            if (opt.header)
+            {
+                for (size_t e = 0; e < opt.expressions.size(); ++e)
+                {
+                    w.text(opt.expressions[e]);
+                    w.put(e + 1 < opt.expressions.size() ? opt.delimiter : '\n');
+                }
+            }
+            std::unique_ptr<Chunk> chunk;
+            while (evaluated.pop(chunk))
+            {
+                for (size_t r = 0; r < chunk->rows; ++r)
+                {
+                    for (size_t e = 0; e < chunk->results.size(); ++e)
+                    {
+                        w.number(chunk->results[e][r]);
+                        w.put(e + 1 < chunk->results.size() ? opt.delimiter : '\n');
+                    }
+                }
+                total_rows += chunk->rows;
+            } });
+
+        auto fresh = [ncols]()
+        {
+            auto chunk = std::make_unique<Chunk>();
+            chunk->columns.resize(ncols);
+            for (auto &c : chunk->columns)
+            {
+                c.resize(ChunkRows);
+            }
+            return chunk;
+        };
+        auto chunk = fresh();
+        while (pending || reader.next(line))
+        {
+            if (!pending)
+            {
+                if (trim(line).empty())
+                {
+                    continue;
+                }
+                splitFields(line, opt.delimiter, fields);
+            }
+            pending = false;
+            for (size_t c = 0; c < ncols; ++c)
+            {
+                double v;
+                chunk->columns[c][chunk->rows] = c < fields.size() && parseNumber(fields[c], v) ? v : NAN;
+            }
+            if (++chunk->rows == ChunkRows)
+            {
+                parsed.push(std::move(chunk));
+                chunk = fresh();
+            }
+        }
+        if (chunk->rows > 0)
+        {
+            parsed.push(std::move(chunk));
+        }
+        parsed.close();
+        evaluator.join();
+        writer.join();
+
+        if (in != stdin)
+        {
+            std::fclose(in);
+        }
+        if (out != stdout)
+        {
+            std::fclose(out);
+        }
+        else
+        {
+            std::fflush(out);
+        }
+        return total_rows;
+    }
+
+    inline void usage()
+    {
+        std::fprintf(stderr,
+                     "usage: program --batch [-e EXPR]... [-f EXPR_FILE] [-i INPUT] [-o OUTPUT]\n"
+                     "                       [-d DELIMITER] [--header]\n"
+                     "  INPUT is CSV or one value per line ('-' or none: stdin); a first line\n"
+                     "  that is not numeric names the columns, otherwise they bind the\n"
+                     "  variables in alphabetical order. OUTPUT gets one column per EXPR.\n");
+    }
+
+    // Entry point for `program --batch ...`; args excludes the program name
+    // and the --batch flag itself.
+    inline int main(int argc, char *argv[])
+    {
+        Options opt;
+        for (int i = 0; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--header")
+            {
+                opt.header = true;
+            }
+            else if (arg == "-e" && has_value)
+            {
+                opt.expressions.push_back(argv[++i]);
+            }
+            else if (arg == "-f" && has_value)
+            {
+                for (auto &e : readExpressions(argv[++i]))
+                {
+                    opt.expressions.push_back(e);
+                }
+            }
+            else if (arg == "-i" && has_value)
+            {
+                opt.input = argv[++i];
+            }
+            else if (arg == "-o" && has_value)
+            {
+                opt.output = argv[++i];
+            }
+            else if (arg == "-d" && has_value && std::strlen(argv[i + 1]) == 1)
+            {
+                opt.delimiter = argv[++i][0];
+            }
+            else
+            {
+                usage();
+                return 2;
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        const size_t rows = run(opt);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::fprintf(stderr, "[*] %zu rows x %zu expressions in %.3f s (%.0f rows/s)\n",
+                     rows, opt.expressions.size(), seconds, seconds > 0 ? rows / seconds : 0.0);
+        return 0;
+    }
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef MATH_BUNDLE_H
+#define MATH_BUNDLE_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+#include "MathParser.hpp"
+#include "MathOptimizer.hpp"
+
+namespace mbundle
+{
+    // Many expressions over the same inputs compiled into one register
+    // program: subexpressions they have in common ("sin(x)", "x^2", ...) are
+    // computed once, and evaluate() makes a single blocked pass over the
+    // inputs, producing every output for one block of points before moving to
+    // the next: the input block is read from L1 by every expression, and each
+    // output is copied out as soon as it is computed so its register is free
+    // for the expressions after it.
+    //
+    // Each output is bitwise identical to evaluating its expression on its own.
+    class ExpressionBundle
+    {
+    public:
+        struct Stats
+        {
+            size_t expressions;
+            size_t instructions; // stack program instructions, summed over expressions
+            size_t ops;          // register ops, after sharing and folding
+            size_t constants;
+            size_t registers;
+        };
+
+        explicit ExpressionBundle(const std::vector<std::string> &sources)
+            : sources(sources)
+        {
+            std::vector<MathParser> parsers;
+            parsers.reserve(sources.size());
+            std::set<char> used;
+            for (auto &source : sources)
+            {
+                parsers.emplace_back(source);
+                used.insert(parsers.back().variables().begin(), parsers.back().variables().end());
+            }
+            slots.assign(used.begin(), used.end());
+
+            moptimize::Dag dag;
+            std::vector<uint32_t> roots;
+            std::vector<uint8_t> slot_map;
+            for (auto &parser : parsers)
+            {
+                const MathParser::CompiledView view = parser.compiled();
+                slot_map.clear();
+                for (size_t s = 0; s < view.slot_count; ++s)
+                {
+                    slot_map.push_back(std::find(slots.begin(), slots.end(), view.slots[s]) - slots.begin());
+                }
+                roots.push_back(dag.add(view.code, view.length, slot_map.data()));
+                instructions += view.length;
+            }
+            program = dag.emit(roots);
+            probes.resize(sources.size());
+            for (size_t i = 0; i < sources.size(); ++i)
+            {
+                probes[i].attach(sources[i]);
+            }
+        }
+
+        // Variable names in slot order, sorted: inputs[i] feeds variables()[i].
+        const std::vector<char> &variables() const
+        {
+            return slots;
+        }
+        size_t size() const
+        {
+            return sources.size();
+        }
+        const std::string &source(size_t i) const
+        {
+            return sources[i];
+        }
+
+        // Evaluates every expression at n points. inputs holds one column of n
+        // values per variable, outs[i] receives the n results of expression i.
+        void evaluate(const double *const *inputs, double *const *outs, size_t n) const
+        {
+            const uint64_t t0 = probes.empty() ? 0 : probes.front().beginBatch();
+            program.evaluateBatch(inputs, outs, n);
+            endProbes(t0, n);
+        }
+        // Evaluates every expression at a single point into out[0 .. size()).
+        void evaluate(const double *values, double *out) const
+        {
+            const uint64_t t0 = probes.empty() ? 0 : probes.front().beginBatch();
+            program.evaluateAll(values, out);
+            endProbes(t0, 1);
+        }
+
+        Stats stats() const
+        {
+            return {sources.size(), instructions, program.ops.size(), program.constants.size(), program.registers};
+        }
+
+    private:
+        // The points and cycles of a pass go to the stats of every source, the
+        // same entries as a MathParser of that source, in equal shares.
+        void endProbes(uint64_t start, size_t points) const
+        {
+            for (auto &probe : probes)
+            {
+                probe.endShared(start, points, probes.size());
+            }
+        }
+
+        std::vector<std::string> sources;
+        std::vector<mprof::ExpressionProbe> probes;
+        std::vector<char> slots;
+        moptimize::RegisterProgram program;
+        size_t instructions = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef MATH_BYTECODE_H
+#define MATH_BYTECODE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Instruction set shared by the compiled forms of an expression: the stack
+// program of MathParser and the register programs of moptimize.
+namespace mbytecode
+{
+    // Keep in sync with mprof::OpNames and bump mserial::Version on change.
+    enum OpCode : uint8_t
+    {
+        Const,
+        Load,
+        Neg,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Pow,
+        Sin,
+        Asin,
+        Sinh,
+        Cos,
+        Acos,
+        Cosh,
+        Tan,
+        Atan,
+        Tanh,
+        Log,
+        Ln,
+        Sqrt,
+        Abs
+    };
+    struct Instruction
+    {
+        OpCode op;
+        uint8_t slot = 0; // index of the variable for OpCode::Load
+        double value = 0; // literal for OpCode::Const
+    };
+
+    inline bool isBinary(OpCode op)
+    {
+        return op >= OpCode::Add && op <= OpCode::Pow;
+    }
+
+    // Result of a function opcode (Sin ... Abs) applied to v.
+    inline double applyFunction(OpCode op, double v)
+    {
+        switch (op)
+        {
+        case OpCode::Sin:
+            return std::sin(v);
+        case OpCode::Asin:
+            return std::asin(v);
+        case OpCode::Sinh:
+            return std::sinh(v);
+        case OpCode::Cos:
+            return std::cos(v);
+        case OpCode::Acos:
+            return std::acos(v);
+        case OpCode::Cosh:
+            return std::cosh(v);
+        case OpCode::Tan:
+            return std::tan(v);
+        case OpCode::Atan:
+            return std::atan(v);
+        case OpCode::Tanh:
+            return std::tanh(v);
+        case OpCode::Log:
+            return std::log10(v);
+        case OpCode::Ln:
+            return std::log(v);
+        case OpCode::Sqrt:
+            return std::sqrt(v);
+        case OpCode::Abs:
+            return std::abs(v);
+        default:
+            return v;
+        }
+    }
+
+    // Result of a binary opcode (Add ... Pow).
+    inline double applyBinary(OpCode op, double l, double r)
+    {
+        switch (op)
+        {
+        case OpCode::Add:
+            return l + r;
+        case OpCode::Sub:
+            return l - r;
+        case OpCode::Mul:
+            return l * r;
+        case OpCode::Div:
+            return l / r;
+        case OpCode::Pow:
+            return std::pow(l, r);
+        default:
+            return l;
+        }
+    }
+
+    // Points evaluated together by the batch evaluators: every op runs over a
+    // whole block, so the working set (stack slots or registers times lanes
+    // doubles) stays in L1 and the per-lane loops get auto-vectorized.
+    constexpr size_t BatchLanes = 256;
+
+    // dst[i] = op(a[i]) over one block; dst may be a.
+    template <typename Op>
+    void lanewise(double *dst, const double *a, size_t lanes, Op op)
+    {
+        for (size_t i = 0; i < lanes; ++i)
+        {
+            dst[i] = op(a[i]);
+        }
+    }
+    // dst[i] = op(a[i], b[i]) over one block; dst may be a or b.
+    template <typename Op>
+    void lanewise(double *dst, const double *a, const double *b, size_t lanes, Op op)
+    {
+        for (size_t i = 0; i < lanes; ++i)
+        {
+            dst[i] = op(a[i], b[i]);
+        }
+    }
+
+    // Hands chunks 0..count-1 out to one worker per core (the calling thread
+    // included). worker(next) runs once per thread, so it can set up its own
+    // scratch, then loops `for (size_t chunk; next(chunk);)` until none is left.
+    template <typename Worker>
+    void parallelChunks(size_t count, Worker worker)
+    {
+        std::atomic<size_t> next_chunk{0};
+        auto run = [&]()
+        {
+            worker([&](size_t &chunk)
+                   { return (chunk = next_chunk++) < count; });
+        };
+        const size_t workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < workers; ++i)
+        {
+            pool.emplace_back(run);
+        }
+        run();
+        for (auto &t : pool)
+        {
+            t.join();
+        }
+    }
+}
+
+#endif
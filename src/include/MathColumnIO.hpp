@@ -0,0 +1,352 @@
+#ifndef MATH_COLUMN_IO_H
+#define MATH_COLUMN_IO_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "MathParser.hpp"
+
+// Binary column files: one little-endian float64/float32 array per variable,
+// mapped into memory so that MathParser::evaluateBatch reads straight from
+// the input pages and writes straight into the output pages.
+//
+// A column file is a 64 byte ColumnHeader followed by `rows` values. Files
+// without the header magic are read as raw arrays, float32 if the name ends
+// in ".f32" and float64 otherwise.
+namespace mcolumn
+{
+    static_assert(std::endian::native == std::endian::little, "column files are little-endian");
+
+    enum DType : uint8_t
+    {
+        Float64 = 1,
+        Float32 = 2
+    };
+
+    struct ColumnHeader
+    {
+        char magic[4]; // "MPCL"
+        uint16_t version;
+        uint8_t dtype;
+        uint8_t reserved0;
+        uint32_t header_size; // offset of the first value
+        uint32_t reserved1;
+        uint64_t rows;
+        char name[32]; // variable name, NUL padded
+        uint64_t reserved2;
+    };
+    static_assert(sizeof(ColumnHeader) == 64);
+
+    constexpr char Magic[4] = {'M', 'P', 'C', 'L'};
+    constexpr uint16_t Version = 1;
+    // Rows evaluated per task; each worker keeps its float32 scratch this size.
+    constexpr size_t ChunkRows = 1 << 16;
+
+    inline size_t dtypeSize(DType dtype)
+    {
+        return dtype == DType::Float32 ? 4 : 8;
+    }
+
+    class MappedFile
+    {
+    public:
+        // Maps an existing file read-only.
+        explicit MappedFile(const std::string &path)
+        {
+            fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                throw std::runtime_error("cannot open " + path);
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0)
+            {
+                ::close(fd);
+                throw std::runtime_error("cannot stat " + path);
+            }
+            map(st.st_size, PROT_READ, path);
+        }
+        // Creates (or truncates) a file of the given size and maps it read-write.
+        MappedFile(const std::string &path, size_t size)
+        {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || ftruncate(fd, size) != 0)
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+                throw std::runtime_error("cannot create " + path);
+            }
+            map(size, PROT_READ | PROT_WRITE, path);
+        }
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile()
+        {
+            if (length > 0)
+            {
+                munmap(base, length);
+            }
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+        char *data() const
+        {
+            return (char *)base;
+        }
+        size_t size() const
+        {
+            return length;
+        }
+        // Tells the kernel the pages fully inside [offset, offset + bytes) are
+        // done with, so inputs larger than RAM do not pile up in our RSS.
+        void release(size_t offset, size_t bytes) const
+        {
+            const size_t page = sysconf(_SC_PAGESIZE);
+            const size_t begin = (offset + page - 1) / page * page;
+            const size_t end = (offset + bytes) / page * page;
+            if (end > begin)
+            {
+                madvise(data() + begin, end - begin, MADV_DONTNEED);
+            }
+        }
+
+    private:
+        // Throws on failure with fd closed: the constructor never completes,
+        // so the destructor will not close it.
+        void map(size_t size, int prot, const std::string &path)
+        {
+            length = size;
+            if (length == 0)
+            {
+                return;
+            }
+            base = mmap(nullptr, length, prot, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED)
+            {
+                length = 0;
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            madvise(base, length, MADV_SEQUENTIAL);
+        }
+        int fd = -1;
+        void *base = nullptr;
+        size_t length = 0;
+    };
+
+    struct Column
+    {
+        DType dtype = DType::Float64;
+        size_t rows = 0;
+        size_t offset = 0; // of the first value inside the file
+        const char *values = nullptr;
+    };
+
+    inline Column readColumn(const MappedFile &file, const std::string &path)
+    {
+        Column column;
+        const ColumnHeader *header = (const ColumnHeader *)file.data();
+        if (file.size() >= sizeof(ColumnHeader) && std::memcmp(header->magic, Magic, 4) == 0)
+        {
+            if (header->version != Version || (header->dtype != DType::Float64 && header->dtype != DType::Float32))
+            {
+                throw std::runtime_error("unsupported column header in " + path);
+            }
+            column.dtype = (DType)header->dtype;
+            column.offset = header->header_size;
+            column.rows = header->rows;
+            // the mapping is page aligned, so an offset multiple of the value
+            // size keeps the values aligned
+            if (column.offset < sizeof(ColumnHeader) || column.offset % dtypeSize(column.dtype) != 0)
+            {
+                throw std::runtime_error("bad column header size in " + path);
+            }
+            if (column.offset > file.size() || column.rows > (file.size() - column.offset) / dtypeSize(column.dtype))
+            {
+                throw std::runtime_error("truncated column " + path);
+            }
+        }
+        else
+        {
+            column.dtype = path.ends_with(".f32") ? DType::Float32 : DType::Float64;
+            column.rows = file.size() / dtypeSize(column.dtype);
+        }
+        column.values = file.data() + column.offset;
+        return column;
+    }
+
+    inline void writeHeader(char *dst, DType dtype, size_t rows, const std::string &name)
+    {
+        ColumnHeader header{};
+        std::memcpy(header.magic, Magic, 4);
+        header.version = Version;
+        header.dtype = dtype;
+        header.header_size = sizeof(ColumnHeader);
+        header.rows = rows;
+        std::strncpy(header.name, name.c_str(), sizeof(header.name) - 1);
+        std::memcpy(dst, &header, sizeof(header));
+    }
+
+    // Writes values as a column file with header, converting to dtype.
+    inline void writeColumn(const std::string &path, const std::string &name, const double *values,
+                            size_t rows, DType dtype = DType::Float64)
+    {
+        MappedFile file(path, sizeof(ColumnHeader) + rows * dtypeSize(dtype));
+        writeHeader(file.data(), dtype, rows, name);
+        char *dst = file.data() + sizeof(ColumnHeader);
+        if (dtype == DType::Float64)
+        {
+            std::memcpy(dst, values, rows * sizeof(double));
+            return;
+        }
+        float *f = (float *)dst;
+        for (size_t i = 0; i < rows; ++i)
+        {
+            f[i] = (float)values[i];
+        }
+    }
+
+    // Finds the column of a variable in dir: <var>.col, <var>.f64 or <var>.f32.
+    inline std::string columnPath(const std::string &dir, char var)
+    {
+        for (const char *ext : {".col", ".f64", ".f32"})
+        {
+            std::string path = dir + "/" + var + ext;
+            if (access(path.c_str(), R_OK) == 0)
+            {
+                return path;
+            }
+        }
+        throw std::runtime_error(std::string("no column file for variable ") + var + " in " + dir);
+    }
+
+    // Evaluates expression over the columns found in dir and writes the
+    // results to a new column file at out_path. float64 columns are handed to
+    // evaluateBatch in place; float32 ones go through a per-worker scratch
+    // buffer, as does a float32 output. Returns the number of rows.
+    inline size_t evaluateColumns(const MathParser &expression, const std::string &dir,
+                                  const std::string &out_path, DType out_type = DType::Float64)
+    {
+        const std::vector<char> &vars = expression.variables();
+        std::vector<std::unique_ptr<MappedFile>> files;
+        std::vector<Column> columns;
+        size_t rows = vars.empty() ? 1 : SIZE_MAX;
+        for (char var : vars)
+        {
+            std::string path = columnPath(dir, var);
+            files.push_back(std::make_unique<MappedFile>(path));
+            columns.push_back(readColumn(*files.back(), path));
+            if (rows != SIZE_MAX && rows != columns.back().rows)
+            {
+                throw std::runtime_error("columns of different length in " + dir);
+            }
+            rows = columns.back().rows;
+        }
+
+        MappedFile output(out_path, sizeof(ColumnHeader) + rows * dtypeSize(out_type));
+        writeHeader(output.data(), out_type, rows, "result");
+        char *results = output.data() + sizeof(ColumnHeader);
+
+        mbytecode::parallelChunks((rows + ChunkRows - 1) / ChunkRows, [&](auto next)
+        {
+            std::vector<std::vector<double>> scratch(columns.size());
+            std::vector<double> out_scratch;
+            std::vector<const double *> inputs(columns.size());
+            for (size_t chunk; next(chunk);)
+            {
+                const size_t begin = chunk * ChunkRows;
+                const size_t n = std::min(ChunkRows, rows - begin);
+                for (size_t s = 0; s < columns.size(); ++s)
+                {
+                    if (columns[s].dtype == DType::Float64)
+                    {
+                        inputs[s] = (const double *)columns[s].values + begin;
+                        continue;
+                    }
+                    const float *f = (const float *)columns[s].values + begin;
+                    scratch[s].resize(ChunkRows);
+                    std::copy(f, f + n, scratch[s].begin());
+                    inputs[s] = scratch[s].data();
+                }
+                if (out_type == DType::Float64)
+                {
+                    expression.evaluateBatch(inputs.data(), (double *)results + begin, n);
+                }
+                else
+                {
+                    out_scratch.resize(ChunkRows);
+                    expression.evaluateBatch(inputs.data(), out_scratch.data(), n);
+                    std::copy(out_scratch.begin(), out_scratch.begin() + n, (float *)results + begin);
+                }
+                for (size_t s = 0; s < columns.size(); ++s)
+                {
+                    const size_t width = dtypeSize(columns[s].dtype);
+                    files[s]->release(columns[s].offset + begin * width, n * width);
+                }
+            }
+        });
+        return rows;
+    }
+
+    // Entry point for `program --columns ...`; args excludes the program name
+    // and the --columns flag itself.
+    inline int main(int argc, char *argv[])
+    {
+        std::string dir, expression, out_path;
+        DType out_type = DType::Float64;
+        for (int i = 0; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--float32")
+            {
+                out_type = DType::Float32;
+            }
+            else if (arg == "-e" && i + 1 < argc)
+            {
+                expression = argv[++i];
+            }
+            else if (arg == "-o" && i + 1 < argc)
+            {
+                out_path = argv[++i];
+            }
+            else if (dir.empty() && arg[0] != '-')
+            {
+                dir = arg;
+            }
+            else
+            {
+                dir.clear();
+                break;
+            }
+        }
+        if (dir.empty() || expression.empty() || out_path.empty())
+        {
+            std::fprintf(stderr,
+                         "usage: program --columns DIR -e EXPR -o OUTPUT [--float32]\n"
+                         "  every variable v of EXPR is read from DIR/v.col, DIR/v.f64 or DIR/v.f32\n");
+            return 2;
+        }
+        auto start = std::chrono::steady_clock::now();
+        const size_t rows = evaluateColumns(MathParser(expression), dir, out_path, out_type);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::fprintf(stderr, "[*] %zu rows in %.3f s (%.0f rows/s)\n", rows, seconds, seconds > 0 ? rows / seconds : 0.0);
+        return 0;
+    }
+}
+
+#endif
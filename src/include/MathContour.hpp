@@ -0,0 +1,152 @@
+#ifndef MATH_CONTOUR_H
+#define MATH_CONTOUR_H
+
+#include <cmath>
+#include <vector>
+#include <assert.h>
+
+namespace mcontour
+{
+    struct Point
+    {
+        double x;
+        double y;
+    };
+    struct Segment
+    {
+        Point a;
+        Point b;
+    };
+
+    // Marching squares over a row-major nx * ny grid as produced by
+    // MathParser::evaluateGrid with the same bounds: returns the segments of the
+    // iso-line f(x, y) == level. Cells touching a NaN sample are skipped and
+    // saddle cells are resolved with the average of their four corners.
+    inline std::vector<Segment> marchingSquares(const double *grid, size_t nx, size_t ny,
+                                                double x0, double x1, double y0, double y1, double level)
+    {
+        std::vector<Segment> segments;
+        if (nx < 2 || ny < 2)
+        {
+            return segments;
+        }
+        const double dx = (x1 - x0) / (nx - 1);
+        const double dy = (y1 - y0) / (ny - 1);
+        // position of level along the edge going from value a to value b
+        auto lerp = [level](double a, double b)
+        {
+            return a == b ? 0.5 : (level - a) / (b - a);
+        };
+        for (size_t r = 0; r + 1 < ny; ++r)
+        {
+            const double *lo = grid + r * nx;
+            const double *hi = lo + nx;
+            const double yb = y0 + r * dy;
+            for (size_t c = 0; c + 1 < nx; ++c)
+            {
+                // corners counter-clockwise from bottom left
+                const double v0 = lo[c], v1 = lo[c + 1], v2 = hi[c + 1], v3 = hi[c];
+                if (std::isnan(v0) || std::isnan(v1) || std::isnan(v2) || std::isnan(v3))
+                {
+                    continue;
+                }
+                const int mask = (v0 > level) | (v1 > level) << 1 | (v2 > level) << 2 | (v3 > level) << 3;
+                if (mask == 0 || mask == 15)
+                {
+                    continue;
+                }
+                const double xl = x0 + c * dx;
+                // crossing points on the bottom, right, top and left edges
+                const Point edge[4] = {
+                    {xl + lerp(v0, v1) * dx, yb},
+                    {xl + dx, yb + lerp(v1, v2) * dy},
+                    {xl + lerp(v3, v2) * dx, yb + dy},
+                    {xl, yb + lerp(v0, v3) * dy}};
+                auto emit = [&](int e0, int e1)
+                {
+                    segments.push_back({edge[e0], edge[e1]});
+                };
+                switch (mask)
+                {
+                case 1:
+                case 14:
+                    emit(3, 0);
+                    break;
+                case 2:
+                case 13:
+                    emit(0, 1);
+                    break;
+                case 3:
+                case 12:
+                    emit(3, 1);
+                    break;
+                case 4:
+                case 11:
+                    emit(1, 2);
+                    break;
+                case 6:
+                case 9:
+                    emit(0, 2);
+                    break;
+                case 7:
+                case 8:
+                    emit(3, 2);
+                    break;
+                case 5:
+                case 10:
+                {
+                    const bool center = (v0 + v1 + v2 + v3) / 4 > level;
+                    // the center joins the corners that share its side of level
+                    if ((mask == 5) == center)
+                    {
+                        emit(3, 2);
+                        emit(0, 1);
+                    }
+                    else
+                    {
+                        emit(3, 0);
+                        emit(1, 2);
+                    }
+                }
+                break;
+                default:
+                    assert(false);
+                }
+            }
+        }
+        return segments;
+    }
+
+    // Marks, in a row-major nx * ny mask over the same grid, the samples
+    // nearest to the ends and the middle of every segment: enough to draw the
+    // iso-lines cell by cell on a console heatmap.
+    inline std::vector<bool> rasterize(const std::vector<Segment> &segments, size_t nx, size_t ny,
+                                       double x0, double x1, double y0, double y1)
+    {
+        std::vector<bool> marks(nx * ny, false);
+        if (nx < 2 || ny < 2)
+        {
+            return marks;
+        }
+        const double dx = (x1 - x0) / (nx - 1);
+        const double dy = (y1 - y0) / (ny - 1);
+        auto mark = [&](Point p)
+        {
+            const double c = std::round((p.x - x0) / dx);
+            const double r = std::round((p.y - y0) / dy);
+            if (c >= 0 && c < nx && r >= 0 && r < ny)
+            {
+                marks[size_t(r) * nx + size_t(c)] = true;
+            }
+        };
+        for (const Segment &s : segments)
+        {
+            mark(s.a);
+            mark(s.b);
+            mark({(s.a.x + s.b.x) / 2, (s.a.y + s.b.y) / 2});
+        }
+        return marks;
+    }
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <cmath>
 #include <functional>
+#include <algorithm>
+#include <vector>
 #include <assert.h>
 
 using std::cout;
@@ -332,6 +334,44 @@ namespace mfgc
         return arr;
     }
 
+    // Renders a row-major _width * _height buffer (e.g. filled by
+    // MathParser::evaluateGrid) as a heatmap: row 0 is drawn at the bottom,
+    // values are scaled between the finite min and max, NaN and inf are black.
+    // Cells set in marks (same layout, e.g. from mcontour::rasterize) get a dot.
+    inline void heatmap(const double *values, int _width, int _height, const std::vector<bool> &marks = {})
+    {
+        static const int ramp[] = {17, 19, 21, 27, 33, 39, 45, 51, 50, 49, 48, 47, 46,
+                                   82, 118, 154, 190, 226, 220, 214, 208, 202, 196};
+        const int steps = sizeof(ramp) / sizeof(ramp[0]);
+        double lo = INFINITY;
+        double hi = -INFINITY;
+        for (int i = 0; i < _width * _height; ++i)
+        {
+            if (std::isfinite(values[i]))
+            {
+                lo = std::min(lo, values[i]);
+                hi = std::max(hi, values[i]);
+            }
+        }
+        const double span = hi > lo ? hi - lo : 1.0;
+        for (int r = _height - 1; r >= 0; --r)
+        {
+            for (int c = 0; c < _width; ++c)
+            {
+                const double v = values[r * _width + c];
+                if (!std::isfinite(v))
+                {
+                    cout << "\033[40m   ";
+                    continue;
+                }
+                const int level = std::clamp((int)((v - lo) / span * steps), 0, steps - 1);
+                const bool marked = !marks.empty() && marks[r * _width + c];
+                cout << "\033[48;5;" << ramp[level] << (marked ? "m\033[97m • \033[39m" : "m   ");
+            }
+            cout << "\033[49m" << std::endl;
+        }
+        cout << "\033[90m min " << lo << "  max " << hi << "\033[39m" << std::endl;
+    }
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,217 @@
+#ifndef MATH_INCREMENTAL_H
+#define MATH_INCREMENTAL_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <bit>
+#include <cstdint>
+#include <assert.h>
+
+#include "MathParser.hpp"
+
+namespace mincremental
+{
+    // Evaluation handle that keeps the value of every subexpression and, when
+    // variables change, recomputes only the subexpressions depending on them:
+    // for a sweep over one variable of a many-parameter formula each update
+    // costs the path from that variable to the root instead of the whole RPN.
+    //
+    // Nodes are the instructions of the compiled program, so they are already
+    // in dependency order: recomputing the affected nodes front to back always
+    // sees up to date operands.
+    class IncrementalEvaluator
+    {
+    public:
+        explicit IncrementalEvaluator(const MathParser &expression)
+            : IncrementalEvaluator(expression.compiled())
+        {
+        }
+        // The view (e.g. a mapped library record) only has to live through the
+        // constructor.
+        explicit IncrementalEvaluator(const MathParser::CompiledView &expr)
+            : slots(expr.slots, expr.slots + expr.slot_count),
+              slot_values(expr.slot_count, 0.0),
+              affected(expr.slot_count)
+        {
+            assert(expr.slot_count <= 64);
+            std::vector<uint32_t> stack;
+            for (size_t i = 0; i < expr.length; ++i)
+            {
+                Node node{expr.code[i], 0, 0, 0};
+                switch (node.ins.op)
+                {
+                case MathParser::OpCode::Const:
+                    break;
+                case MathParser::OpCode::Load:
+                    node.depends = uint64_t(1) << node.ins.slot;
+                    break;
+                case MathParser::OpCode::Add:
+                case MathParser::OpCode::Sub:
+                case MathParser::OpCode::Mul:
+                case MathParser::OpCode::Div:
+                case MathParser::OpCode::Pow:
+                    node.rhs = stack.back();
+                    stack.pop_back();
+                    node.lhs = stack.back();
+                    stack.pop_back();
+                    node.depends = nodes[node.lhs].depends | nodes[node.rhs].depends;
+                    break;
+                default:
+                    node.lhs = stack.back();
+                    stack.pop_back();
+                    node.depends = nodes[node.lhs].depends;
+                    break;
+                }
+                stack.push_back(nodes.size());
+                nodes.push_back(node);
+                values.push_back(0.0);
+                for (size_t s = 0; s < slots.size(); ++s)
+                {
+                    if (node.depends >> s & 1)
+                    {
+                        affected[s].push_back(i);
+                    }
+                }
+            }
+            root = stack.empty() ? nodes.size() : stack.front();
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                recompute(i);
+            }
+        }
+
+        // Sets a variable; variables the expression does not use are ignored.
+        // The affected subexpressions are recomputed on the next value().
+        void set(char var, double value)
+        {
+            for (size_t s = 0; s < slots.size(); ++s)
+            {
+                if (slots[s] == var)
+                {
+                    setSlot(s, value);
+                    return;
+                }
+            }
+        }
+        void set(const std::map<std::string, double> &variables)
+        {
+            for (auto &[name, value] : variables)
+            {
+                if (name.size() == 1)
+                {
+                    set(name[0], value);
+                }
+            }
+        }
+        void setSlot(size_t slot, double value)
+        {
+            assert(slot < slots.size());
+            // bitwise: -0.0 == 0.0, yet 1/x tells them apart
+            if (std::bit_cast<uint64_t>(slot_values[slot]) != std::bit_cast<uint64_t>(value))
+            {
+                slot_values[slot] = value;
+                dirty |= uint64_t(1) << slot;
+            }
+        }
+
+        double value()
+        {
+            if (dirty != 0)
+            {
+                if ((dirty & (dirty - 1)) == 0)
+                {
+                    // a single variable changed: walk its precomputed node list
+                    for (uint32_t i : affected[__builtin_ctzll(dirty)])
+                    {
+                        recompute(i);
+                    }
+                }
+                else
+                {
+                    for (size_t i = 0; i < nodes.size(); ++i)
+                    {
+                        if (nodes[i].depends & dirty)
+                        {
+                            recompute(i);
+                        }
+                    }
+                }
+                dirty = 0;
+            }
+            return root < values.size() ? values[root] : NAN;
+        }
+
+        const std::vector<char> &variables() const
+        {
+            return slots;
+        }
+        // Number of nodes a change of var recomputes.
+        size_t affectedBy(char var) const
+        {
+            for (size_t s = 0; s < slots.size(); ++s)
+            {
+                if (slots[s] == var)
+                {
+                    return affected[s].size();
+                }
+            }
+            return 0;
+        }
+
+    private:
+        struct Node
+        {
+            MathParser::Instruction ins;
+            uint32_t lhs;
+            uint32_t rhs;
+            uint64_t depends; // bit s set when the node reads slot s
+        };
+
+        void recompute(size_t i)
+        {
+            const Node &node = nodes[i];
+            double &v = values[i];
+            switch (node.ins.op)
+            {
+            case MathParser::OpCode::Const:
+                v = node.ins.value;
+                break;
+            case MathParser::OpCode::Load:
+                v = slot_values[node.ins.slot];
+                break;
+            case MathParser::OpCode::Neg:
+                v = -values[node.lhs];
+                break;
+            case MathParser::OpCode::Add:
+                v = values[node.lhs] + values[node.rhs];
+                break;
+            case MathParser::OpCode::Sub:
+                v = values[node.lhs] - values[node.rhs];
+                break;
+            case MathParser::OpCode::Mul:
+                v = values[node.lhs] * values[node.rhs];
+                break;
+            case MathParser::OpCode::Div:
+                v = values[node.lhs] / values[node.rhs];
+                break;
+            case MathParser::OpCode::Pow:
+                v = std::pow(values[node.lhs], values[node.rhs]);
+                break;
+            default:
+                v = mbytecode::applyFunction(node.ins.op, values[node.lhs]);
+                break;
+            }
+        }
+
+        std::vector<char> slots;
+        std::vector<double> slot_values;
+        std::vector<Node> nodes;
+        std::vector<double> values;
+        std::vector<std::vector<uint32_t>> affected; // per slot, in node order
+        size_t root = 0; // node left at the bottom of the stack, as in evaluateCompiled
+        uint64_t dirty = 0;
+    };
+}
+
+#endif
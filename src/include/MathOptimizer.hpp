@@ -0,0 +1,429 @@
+#ifndef MATH_OPTIMIZER_H
+#define MATH_OPTIMIZER_H
+
+#include <vector>
+#include <map>
+#include <tuple>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "MathBytecode.hpp"
+#include "MathProfile.hpp"
+
+// Register programs: the optimized compiled form of one or more expressions.
+// The stack program is first turned into a DAG where identical subtrees are
+// shared (common subexpression elimination), constant subtrees are folded and
+// a few exact rewrites are applied; the DAG is then emitted as three-address
+// ops over numbered registers. Both evaluators feed the per-opcode counters
+// of mprof; hoisted constants are not ops and are not counted.
+namespace moptimize
+{
+    using mbytecode::BatchLanes;
+    using mbytecode::Instruction;
+    using mbytecode::OpCode;
+
+    struct Op
+    {
+        OpCode op;
+        uint8_t slot = 0; // OpCode::Load
+        uint32_t dst = 0;
+        uint32_t a = 0;
+        uint32_t b = 0;
+        double value = 0; // OpCode::Const
+    };
+
+    // An output is read from reg once the first after ops have run; its
+    // register may be reused by the ops after that.
+    struct Output
+    {
+        size_t after;
+        uint32_t reg;
+        uint32_t index; // position among the program's outputs
+    };
+
+    struct RegisterProgram
+    {
+        std::vector<Op> constants;   // written once per call, never reused
+        std::vector<Op> ops;         // no OpCode::Const in here
+        std::vector<Output> outputs; // ordered by after
+        size_t registers = 0;
+
+        // Scalar evaluation of the first output; values[i] is slot i.
+        double evaluate(const double *values) const
+        {
+            double small[64];
+            std::vector<double> large(registers > 64 ? registers : 0);
+            double *regs = registers > 64 ? large.data() : small;
+            if (outputs.size() == 1)
+            {
+                double out = NAN;
+                run(values, regs, &out);
+                return out;
+            }
+            std::vector<double> out(outputs.size(), NAN);
+            run(values, regs, out.data());
+            return out.empty() ? NAN : out[0];
+        }
+        // Scalar evaluation of every output into out[0 .. outputs.size()).
+        void evaluateAll(const double *values, double *out) const
+        {
+            std::vector<double> regs(registers);
+            run(values, regs.data(), out);
+        }
+        // Evaluates n points block by block; inputs holds one column per slot
+        // and outs one column per output. Every output is copied out of its
+        // register right after the op computing it.
+        void evaluateBatch(const double *const *inputs, double *const *outs, size_t n) const
+        {
+            std::vector<double> regs(std::max<size_t>(registers, 1) * BatchLanes);
+            for (const Op &k : constants)
+            {
+                std::fill(&regs[k.dst * BatchLanes], &regs[k.dst * BatchLanes] + BatchLanes, k.value);
+            }
+            for (size_t base = 0; base < n; base += BatchLanes)
+            {
+                const size_t lanes = std::min(BatchLanes, n - base);
+                size_t done = 0;
+                for (const Output &o : outputs)
+                {
+                    for (; done < o.after; ++done)
+                    {
+                        const uint64_t t0 = mprof::opBegin();
+                        runBlock(ops[done], inputs, regs.data(), base, lanes);
+                        mprof::opEnd(ops[done].op, lanes, t0);
+                    }
+                    const double *src = &regs[o.reg * BatchLanes];
+                    std::copy(src, src + lanes, outs[o.index] + base);
+                }
+            }
+        }
+
+    private:
+        void run(const double *values, double *regs, double *out) const
+        {
+            for (const Op &k : constants)
+            {
+                regs[k.dst] = k.value;
+            }
+            size_t done = 0;
+            for (const Output &o : outputs)
+            {
+                for (; done < o.after; ++done)
+                {
+                    const Op &op = ops[done];
+                    const uint64_t t0 = mprof::opBegin();
+                    switch (op.op)
+                    {
+                    case OpCode::Load:
+                        regs[op.dst] = values[op.slot];
+                        break;
+                    case OpCode::Neg:
+                        regs[op.dst] = -regs[op.a];
+                        break;
+                    default:
+                        regs[op.dst] = mbytecode::isBinary(op.op) ? mbytecode::applyBinary(op.op, regs[op.a], regs[op.b])
+                                                                  : mbytecode::applyFunction(op.op, regs[op.a]);
+                        break;
+                    }
+                    mprof::opEnd(op.op, 1, t0);
+                }
+                out[o.index] = regs[o.reg];
+            }
+        }
+        void runBlock(const Op &op, const double *const *inputs, double *regs, size_t base, size_t lanes) const
+        {
+            double *dst = &regs[op.dst * BatchLanes];
+            const double *a = &regs[op.a * BatchLanes];
+            const double *b = &regs[op.b * BatchLanes];
+            switch (op.op)
+            {
+            case OpCode::Load:
+                std::copy(inputs[op.slot] + base, inputs[op.slot] + base + lanes, dst);
+                break;
+            case OpCode::Neg:
+                mbytecode::lanewise(dst, a, lanes, [](double v)
+                                    { return -v; });
+                break;
+            case OpCode::Add:
+                mbytecode::lanewise(dst, a, b, lanes, [](double l, double r)
+                                    { return l + r; });
+                break;
+            case OpCode::Sub:
+                mbytecode::lanewise(dst, a, b, lanes, [](double l, double r)
+                                    { return l - r; });
+                break;
+            case OpCode::Mul:
+                mbytecode::lanewise(dst, a, b, lanes, [](double l, double r)
+                                    { return l * r; });
+                break;
+            case OpCode::Div:
+                mbytecode::lanewise(dst, a, b, lanes, [](double l, double r)
+                                    { return l / r; });
+                break;
+            case OpCode::Pow:
+                mbytecode::lanewise(dst, a, b, lanes, [](double l, double r)
+                                    { return std::pow(l, r); });
+                break;
+            default:
+                mbytecode::lanewise(dst, a, lanes, [op = op.op](double v)
+                                    { return mbytecode::applyFunction(op, v); });
+                break;
+            }
+        }
+    };
+
+    // Hash-consed expression DAG. Children always have smaller ids than their
+    // parents, so id order is an evaluation order.
+    class Dag
+    {
+    public:
+        struct Node
+        {
+            OpCode op;
+            uint8_t slot;
+            uint32_t a;
+            uint32_t b;
+            double value;
+        };
+
+        // Adds a stack program and returns the id of its result. Programs
+        // added to the same Dag share their common subexpressions; slot
+        // numbers are remapped through slot_map when given.
+        uint32_t add(const Instruction *code, size_t length, const uint8_t *slot_map = nullptr)
+        {
+            std::vector<uint32_t> stack;
+            for (size_t i = 0; i < length; ++i)
+            {
+                const Instruction &ins = code[i];
+                if (ins.op == OpCode::Const)
+                {
+                    stack.push_back(constant(ins.value));
+                }
+                else if (ins.op == OpCode::Load)
+                {
+                    stack.push_back(intern({OpCode::Load, slot_map ? slot_map[ins.slot] : ins.slot, 0, 0, 0}));
+                }
+                else if (mbytecode::isBinary(ins.op))
+                {
+                    const uint32_t b = stack.back();
+                    stack.pop_back();
+                    stack.back() = binary(ins.op, stack.back(), b);
+                }
+                else
+                {
+                    stack.back() = unary(ins.op, stack.back());
+                }
+            }
+            return stack.empty() ? constant(NAN) : stack.front();
+        }
+
+        // Emits the nodes reachable from roots, output i being roots[i].
+        // Constants are hoisted out of the per-block ops and the other
+        // registers are reused as soon as their value is dead, outputs
+        // included once copied out, which keeps the batch working set small
+        // however many outputs there are.
+        RegisterProgram emit(const std::vector<uint32_t> &roots) const
+        {
+            std::vector<bool> live(nodes.size(), false);
+            for (uint32_t r : roots)
+            {
+                live[r] = true;
+            }
+            for (size_t i = nodes.size(); i-- > 0;)
+            {
+                if (live[i] && nodes[i].op != OpCode::Const && nodes[i].op != OpCode::Load)
+                {
+                    live[nodes[i].a] = true;
+                    if (mbytecode::isBinary(nodes[i].op))
+                    {
+                        live[nodes[i].b] = true;
+                    }
+                }
+            }
+            // last node reading each node
+            std::vector<size_t> last_use(nodes.size(), 0);
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                if (!live[i] || nodes[i].op == OpCode::Const || nodes[i].op == OpCode::Load)
+                {
+                    continue;
+                }
+                last_use[nodes[i].a] = i;
+                if (mbytecode::isBinary(nodes[i].op))
+                {
+                    last_use[nodes[i].b] = i;
+                }
+            }
+            std::vector<std::vector<uint32_t>> outputs_of(nodes.size());
+            for (size_t r = 0; r < roots.size(); ++r)
+            {
+                outputs_of[roots[r]].push_back(r);
+            }
+
+            RegisterProgram program;
+            std::vector<uint32_t> reg(nodes.size(), 0);
+            std::vector<uint32_t> free_regs;
+            auto take = [&]()
+            {
+                if (free_regs.empty())
+                {
+                    return (uint32_t)program.registers++;
+                }
+                const uint32_t r = free_regs.back();
+                free_regs.pop_back();
+                return r;
+            };
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                if (!live[i])
+                {
+                    continue;
+                }
+                const Node &n = nodes[i];
+                Op op;
+                op.op = n.op;
+                op.slot = n.slot;
+                op.value = n.value;
+                if (n.op == OpCode::Const)
+                {
+                    // never a recycled register: ops before it would clobber it
+                    op.dst = reg[i] = program.registers++;
+                    program.constants.push_back(op);
+                }
+                else
+                {
+                    if (n.op != OpCode::Load)
+                    {
+                        op.a = reg[n.a];
+                        op.b = mbytecode::isBinary(n.op) ? reg[n.b] : op.a;
+                        // operands dying here hand their register to the result;
+                        // constants keep theirs since they are only written once
+                        for (uint32_t child : {n.a, n.b})
+                        {
+                            if (last_use[child] == i && nodes[child].op != OpCode::Const &&
+                                (child == n.a || mbytecode::isBinary(n.op)) &&
+                                std::find(free_regs.begin(), free_regs.end(), reg[child]) == free_regs.end())
+                            {
+                                free_regs.push_back(reg[child]);
+                            }
+                        }
+                    }
+                    op.dst = reg[i] = take();
+                    program.ops.push_back(op);
+                }
+                for (uint32_t index : outputs_of[i])
+                {
+                    program.outputs.push_back({program.ops.size(), reg[i], index});
+                }
+                // an output nothing else reads is dead once copied out
+                if (!outputs_of[i].empty() && last_use[i] == 0 && n.op != OpCode::Const)
+                {
+                    free_regs.push_back(reg[i]);
+                }
+            }
+            return program;
+        }
+
+        size_t size() const
+        {
+            return nodes.size();
+        }
+
+    private:
+        uint32_t intern(const Node &n)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &n.value, sizeof(bits));
+            auto key = std::make_tuple((uint8_t)n.op, n.slot, n.a, n.b, bits);
+            auto it = index.find(key);
+            if (it != index.end())
+            {
+                return it->second;
+            }
+            nodes.push_back(n);
+            index.emplace(key, nodes.size() - 1);
+            return nodes.size() - 1;
+        }
+        uint32_t constant(double v)
+        {
+            return intern({OpCode::Const, 0, 0, 0, v});
+        }
+        bool isConstant(uint32_t id, double v) const
+        {
+            return nodes[id].op == OpCode::Const && nodes[id].value == v;
+        }
+        uint32_t unary(OpCode op, uint32_t a)
+        {
+            if (nodes[a].op == OpCode::Const)
+            {
+                return constant(op == OpCode::Neg ? -nodes[a].value : mbytecode::applyFunction(op, nodes[a].value));
+            }
+            if (op == OpCode::Neg && nodes[a].op == OpCode::Neg)
+            {
+                return nodes[a].a;
+            }
+            return intern({op, 0, a, 0, 0});
+        }
+        // Only rewrites that give bitwise identical results: x*1, x/1, x-0
+        // and x^1. x^2 is left to pow, which is not always equal to x*x.
+        uint32_t binary(OpCode op, uint32_t a, uint32_t b)
+        {
+            if (nodes[a].op == OpCode::Const && nodes[b].op == OpCode::Const)
+            {
+                return constant(mbytecode::applyBinary(op, nodes[a].value, nodes[b].value));
+            }
+            switch (op)
+            {
+            case OpCode::Mul:
+                if (isConstant(b, 1))
+                {
+                    return a;
+                }
+                if (isConstant(a, 1))
+                {
+                    return b;
+                }
+                break;
+            case OpCode::Div:
+                if (isConstant(b, 1))
+                {
+                    return a;
+                }
+                break;
+            case OpCode::Sub:
+                if (isConstant(b, 0) && !std::signbit(nodes[b].value))
+                {
+                    return a;
+                }
+                break;
+            case OpCode::Pow:
+                if (isConstant(b, 1))
+                {
+                    return a;
+                }
+                break;
+            default:
+                break;
+            }
+            // a + b and a * b are exactly commutative: one canonical order
+            if ((op == OpCode::Add || op == OpCode::Mul) && a > b)
+            {
+                std::swap(a, b);
+            }
+            return intern({op, 0, a, b, 0});
+        }
+
+        std::vector<Node> nodes;
+        std::map<std::tuple<uint8_t, uint8_t, uint32_t, uint32_t, uint64_t>, uint32_t> index;
+    };
+
+    inline RegisterProgram optimize(const Instruction *code, size_t length)
+    {
+        Dag dag;
+        const uint32_t root = dag.add(code, length);
+        return dag.emit({root});
+    }
+}
+
+#endif
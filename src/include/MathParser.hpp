@@ -10,18 +10,47 @@
 #include <vector>
 #include <map>
 #include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
 #include <assert.h>
 
+#include "MathBytecode.hpp"
+#include "MathProfile.hpp"
+#include "MathTiers.hpp"
+
 struct MathParser
 {
+    // Compiled form of the expression: a flat stack program with numbers
+    // already parsed and function names already resolved.
+    using OpCode = mbytecode::OpCode;
+    using Instruction = mbytecode::Instruction;
+#ifdef MATHPARSER_PROFILE
+    static_assert(OpCode::Abs + 1 == mprof::OpCodeCount, "mprof::OpNames out of sync");
+#endif
+
+    // Points evaluated together by evaluateBatch.
+    static constexpr size_t BatchLanes = mbytecode::BatchLanes;
+    // Rows handed to a worker at a time by evaluateGrid.
+    static constexpr size_t GridRowBlock = 8;
+    // Bound on variables(): variables are single letters.
+    static constexpr size_t MaxSlots = 64;
 
+    // Throws std::invalid_argument when raw is missing an operand ("--x", "+").
     MathParser(const std::string &raw)
     {
+        const uint64_t t0 = mprof::parseBegin();
         std::vector<Token> tokens;
         tokenize(raw, tokens);
         shuntingYard(tokens);
+        compile();
+        mprof::parseEnd(t0);
+        probe.attach(raw);
     }
-    double integrate(double a, double b, size_t n)
+    double integrate(double a, double b, size_t n) const
     {
         double dx = (b - a) / n;
         double area = 0.0;
@@ -31,284 +60,262 @@ struct MathParser
         }
         return area;
     }
-    double evaluate()
+    // Scalar entry points, executed by the current tier of the expression:
+    // the stack program until it is hot, then the optimized program. Both
+    // read the slot values bound by the entry point and give the same doubles.
+    // Variables are taken as 0.
+    double evaluate() const
     {
-        std::vector<double> stack;
-        for (auto &t : output_stack)
+        return tiered([&](double *values)
+                      { std::fill(values, values + slots.size(), 0.0); });
+    }
+    // Every variable of the expression takes the value x.
+    double evaluateFunctionInX(double x) const
+    {
+        return tiered([&](double *values)
+                      { std::fill(values, values + slots.size(), x); });
+    }
+    double evaluateFunction(const std::map<std::string, double> &variables) const
+    {
+        return tiered([&](double *values)
+                      {
+                          for (size_t s = 0; s < slots.size(); ++s)
+                          {
+                              auto it = variables.find(std::string{slots[s]});
+                              assert(it != variables.end());
+                              values[s] = it->second;
+                          } });
+    }
+    mtier::Stats tierStats() const
+    {
+        return tiers->stats();
+    }
+    // Promotes right away in the calling thread, or waits until the caller
+    // that already started the promotion to tier has installed it; either
+    // way the tier is in place on return.
+    void promote(mtier::Tier tier) const
+    {
+        if (tier == mtier::Tier::Interpreter)
         {
-            switch (t.type)
-            {
-            case NodeType::Number:
-                stack.push_back(std::stod(t.str));
-                break;
-            case NodeType::Function:
-            {
-                const double rhs = stack.back();
-                stack.pop_back();
-                if (t.str == "sin")
-                {
-                    stack.push_back(std::sin(rhs));
-                }
-                else if (t.str == "cos")
-                {
-                    stack.push_back(std::cos(rhs));
-                }
-                else if (t.str == "log")
-                {
-                    stack.push_back(std::log10(rhs));
-                }
-                else if (t.str == "ln")
-                {
-                    stack.push_back(std::log(rhs));
-                }
-            }
-            break;
-            case NodeType::Operator:
+            return;
+        }
+        if (tiers->request(tier))
+        {
+            mtier::promote(tiers, tier, program, false);
+            return;
+        }
+        tiers->waitFor(tier);
+    }
+    // Variable names in slot order: inputs[i] of evaluateBatch feeds variables()[i].
+    const std::vector<char> &variables() const
+    {
+        return slots;
+    }
+    // Non-owning view of a compiled expression: the program of a MathParser or
+    // a record mapped straight from a serialized expression library.
+    struct CompiledView
+    {
+        const Instruction *code;
+        size_t length;
+        const char *slots;
+        size_t slot_count;
+        size_t max_depth;
+    };
+    CompiledView compiled() const
+    {
+        return {program.data(), program.size(), slots.data(), slots.size(), max_depth};
+    }
+    // Evaluates the expression at n points. inputs holds one column of n values
+    // per variable slot, out receives the n results.
+    void evaluateBatch(const double *const *inputs, double *out, size_t n) const
+    {
+        const uint64_t t0 = probe.beginBatch();
+        mtier::TierState &state = *tiers;
+        const mtier::Tier tier = (mtier::Tier)state.batch_tier.load(std::memory_order_acquire);
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t before = state.count(tier, n);
+        if (tier == mtier::Tier::Interpreter)
+        {
+            evaluateBatch(compiled(), inputs, out, n);
+            if (before + n >= mtier::policy().vectorize_after.load(std::memory_order_relaxed) &&
+                state.request(mtier::Tier::Vectorized))
             {
-                const double rhs = stack.back();
-                stack.pop_back();
-                if (stack.size() == 0)
-                {
-                    switch (t.str[0])
-                    {
-                    case '+':
-                        stack.push_back(rhs);
-                        break;
-                    case '-':
-                        stack.push_back(-rhs);
-                        break;
-                    }
-                    continue;
-                }
-                const double lhs = stack.back();
-                stack.pop_back();
-                switch (t.str[0])
-                {
-                case '^':
-                    stack.push_back(std::pow(lhs, rhs));
-                    break;
-                case '*':
-                    stack.push_back(lhs * rhs);
-                    break;
-                case '/':
-                    stack.push_back(lhs / rhs);
-                    break;
-                case '+':
-                    stack.push_back(lhs + rhs);
-                    break;
-                case '-':
-                    stack.push_back(lhs - rhs);
-                    break;
-                }
-            }
-            break;
+                mtier::promote(tiers, mtier::Tier::Vectorized, program, mtier::policy().background.load());
             }
         }
-        return stack.back();
+        else
+        {
+            state.vectorized.load(std::memory_order_acquire)->evaluateBatch(inputs, &out, n);
+        }
+        state.addTime(tier, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        probe.endBatch(t0, n);
     }
-    double evaluateFunctionInX(double x)
+    // Evaluates at a single point, values[i] being the value of slot i.
+    static double evaluateCompiled(const CompiledView &expr, const double *values)
     {
-        std::vector<double> stack;
-        for (auto &t : output_stack)
+        double small[32];
+        std::vector<double> large(expr.max_depth > 32 ? expr.max_depth : 0);
+        double *stack = expr.max_depth > 32 ? large.data() : small;
+        size_t sp = 0;
+        for (const Instruction *ins = expr.code; ins != expr.code + expr.length; ++ins)
         {
-            switch (t.type)
+            const uint64_t t0 = mprof::opBegin();
+            switch (ins->op)
             {
-            case NodeType::Number:
-                stack.push_back(std::stod(t.str));
+            case OpCode::Const:
+                stack[sp++] = ins->value;
                 break;
-            case NodeType::Variable:
-                stack.push_back(x);
+            case OpCode::Load:
+                stack[sp++] = values[ins->slot];
+                break;
+            case OpCode::Neg:
+                stack[sp - 1] = -stack[sp - 1];
+                break;
+            case OpCode::Add:
+                --sp;
+                stack[sp - 1] += stack[sp];
+                break;
+            case OpCode::Sub:
+                --sp;
+                stack[sp - 1] -= stack[sp];
+                break;
+            case OpCode::Mul:
+                --sp;
+                stack[sp - 1] *= stack[sp];
+                break;
+            case OpCode::Div:
+                --sp;
+                stack[sp - 1] /= stack[sp];
+                break;
+            case OpCode::Pow:
+                --sp;
+                stack[sp - 1] = std::pow(stack[sp - 1], stack[sp]);
+                break;
+            default:
+                stack[sp - 1] = mbytecode::applyFunction(ins->op, stack[sp - 1]);
                 break;
-            case NodeType::Function:
-            {
-                const double rhs = stack.back();
-                stack.pop_back();
-                if (t.str == "sin")
-                {
-                    stack.push_back(std::sin(rhs));
-                }
-                else if (t.str == "asin")
-                {
-                    stack.push_back(std::asin(rhs));
-                }
-                else if (t.str == "sinh")
-                {
-                    stack.push_back(std::sinh(rhs));
-                }
-                else if (t.str == "cos")
-                {
-                    stack.push_back(std::cos(rhs));
-                }
-                else if (t.str == "acos")
-                {
-                    stack.push_back(std::acos(rhs));
-                }
-                else if (t.str == "cosh")
-                {
-                    stack.push_back(std::cosh(rhs));
-                }
-                else if (t.str == "tan")
-                {
-                    stack.push_back(std::tan(rhs));
-                }
-                else if (t.str == "atan")
-                {
-                    stack.push_back(std::atan(rhs));
-                }
-                else if (t.str == "tanh")
-                {
-                    stack.push_back(std::tanh(rhs));
-                }
-                else if (t.str == "log")
-                {
-                    stack.push_back(std::log10(rhs));
-                }
-                else if (t.str == "ln")
-                {
-                    stack.push_back(std::log(rhs));
-                }
-                else if (t.str == "sqrt")
-                {
-                    stack.push_back(std::sqrt(rhs));
-                }
-                else if (t.str == "abs")
-                {
-                    stack.push_back(std::abs(rhs));
-                }
             }
-            break;
-            case NodeType::Operator:
+            mprof::opEnd(ins->op, 1, t0);
+        }
+        return sp > 0 ? stack[0] : NAN;
+    }
+    static void evaluateBatch(const CompiledView &expr, const double *const *inputs, double *out, size_t n)
+    {
+        std::vector<double> stack(std::max<size_t>(expr.max_depth, 1) * BatchLanes);
+        for (size_t base = 0; base < n; base += BatchLanes)
+        {
+            const size_t lanes = std::min(BatchLanes, n - base);
+            size_t sp = 0;
+            for (const Instruction *it = expr.code; it != expr.code + expr.length; ++it)
             {
-                const double rhs = stack.back();
-                stack.pop_back();
-                const double lhs = stack.back();
-                stack.pop_back();
-                switch (t.str[0])
-                {
-                case '^':
-                    stack.push_back(std::pow(lhs, rhs));
+                const Instruction &ins = *it;
+                const uint64_t t0 = mprof::opBegin();
+                double *top = stack.data() + sp * BatchLanes;
+                switch (ins.op)
+                {
+                case OpCode::Const:
+                    std::fill(top, top + lanes, ins.value);
+                    ++sp;
                     break;
-                case '*':
-                    stack.push_back(lhs * rhs);
+                case OpCode::Load:
+                    std::copy(inputs[ins.slot] + base, inputs[ins.slot] + base + lanes, top);
+                    ++sp;
                     break;
-                case '/':
-                    stack.push_back(lhs / rhs);
-
+                case OpCode::Neg:
+                    mbytecode::lanewise(top - BatchLanes, top - BatchLanes, lanes, [](double v)
+                             { return -v; });
                     break;
-                case '+':
-                    stack.push_back(lhs + rhs);
+                case OpCode::Add:
+                    mbytecode::lanewise(top - 2 * BatchLanes, top - 2 * BatchLanes, top - BatchLanes, lanes, [](double l, double r)
+                             { return l + r; });
+                    --sp;
                     break;
-                case '-':
-                    stack.push_back(lhs - rhs);
+                case OpCode::Sub:
+                    mbytecode::lanewise(top - 2 * BatchLanes, top - 2 * BatchLanes, top - BatchLanes, lanes, [](double l, double r)
+                             { return l - r; });
+                    --sp;
+                    break;
+                case OpCode::Mul:
+                    mbytecode::lanewise(top - 2 * BatchLanes, top - 2 * BatchLanes, top - BatchLanes, lanes, [](double l, double r)
+                             { return l * r; });
+                    --sp;
+                    break;
+                case OpCode::Div:
+                    mbytecode::lanewise(top - 2 * BatchLanes, top - 2 * BatchLanes, top - BatchLanes, lanes, [](double l, double r)
+                             { return l / r; });
+                    --sp;
+                    break;
+                case OpCode::Pow:
+                    mbytecode::lanewise(top - 2 * BatchLanes, top - 2 * BatchLanes, top - BatchLanes, lanes, [](double l, double r)
+                             { return std::pow(l, r); });
+                    --sp;
+                    break;
+                default:
+                    mbytecode::lanewise(top - BatchLanes, top - BatchLanes, lanes, [op = ins.op](double v)
+                             { return mbytecode::applyFunction(op, v); });
                     break;
                 }
+                mprof::opEnd(ins.op, lanes, t0);
             }
-            break;
-            }
+            std::copy(stack.data(), stack.data() + lanes, out + base);
         }
-        return stack.back();
     }
-    double evaluateFunction(const std::map<std::string, double> &variables)
+    // Samples the expression on a nx * ny grid spanning [x0, x1] * [y0, y1]
+    // (endpoints included) into the row-major buffer out, out[r * nx + c] being
+    // f(x_c, y_r). Variables other than xVar and yVar are taken from fixed.
+    // Blocks of GridRowBlock rows are spread over all hardware threads.
+    void evaluateGrid(double x0, double x1, size_t nx, double y0, double y1, size_t ny, double *out,
+                      const std::map<std::string, double> &fixed = {}, char xVar = 'x', char yVar = 'y') const
     {
-        std::vector<double> stack;
-        for (auto &t : output_stack)
+        if (nx == 0 || ny == 0)
         {
-            switch (t.type)
-            {
-            case NodeType::Number:
-                stack.push_back(std::stod(t.str));
-                break;
-            case NodeType::Variable:
-                stack.push_back(variables.find(t.str)->second);
-                break;
-            case NodeType::Function:
+            return;
+        }
+        const double dx = nx > 1 ? (x1 - x0) / (nx - 1) : 0.0;
+        const double dy = ny > 1 ? (y1 - y0) / (ny - 1) : 0.0;
+        std::vector<double> xs(nx);
+        for (size_t c = 0; c < nx; ++c)
+        {
+            xs[c] = x0 + c * dx;
+        }
+        mbytecode::parallelChunks((ny + GridRowBlock - 1) / GridRowBlock, [&](auto next)
+        {
+            // Every slot but x gets a private nx wide column: y is refilled for
+            // each row, the fixed parameters are broadcast once.
+            std::vector<std::vector<double>> columns(slots.size());
+            std::vector<const double *> inputs(slots.size());
+            size_t y_slot = slots.size();
+            for (size_t s = 0; s < slots.size(); ++s)
             {
-                const double rhs = stack.back();
-                stack.pop_back();
-                if (t.str == "sin")
-                {
-                    stack.push_back(std::sin(rhs));
-                }
-                else if (t.str == "asin")
-                {
-                    stack.push_back(std::asin(rhs));
-                }
-                else if (t.str == "sinh")
-                {
-                    stack.push_back(std::sinh(rhs));
-                }
-                else if (t.str == "cos")
-                {
-                    stack.push_back(std::cos(rhs));
-                }
-                else if (t.str == "acos")
-                {
-                    stack.push_back(std::acos(rhs));
-                }
-                else if (t.str == "cosh")
-                {
-                    stack.push_back(std::cosh(rhs));
-                }
-                else if (t.str == "tan")
-                {
-                    stack.push_back(std::tan(rhs));
-                }
-                else if (t.str == "atan")
-                {
-                    stack.push_back(std::atan(rhs));
-                }
-                else if (t.str == "tanh")
-                {
-                    stack.push_back(std::tanh(rhs));
-                }
-                else if (t.str == "log")
-                {
-                    stack.push_back(std::log10(rhs));
-                }
-                else if (t.str == "ln")
-                {
-                    stack.push_back(std::log(rhs));
-                }
-                else if (t.str == "sqrt")
+                if (slots[s] == xVar)
                 {
-                    stack.push_back(std::sqrt(rhs));
+                    inputs[s] = xs.data();
+                    continue;
                 }
-                else if (t.str == "abs")
+                columns[s].resize(nx);
+                inputs[s] = columns[s].data();
+                if (slots[s] == yVar)
                 {
-                    stack.push_back(std::abs(rhs));
+                    y_slot = s;
+                    continue;
                 }
+                auto it = fixed.find(std::string{slots[s]});
+                assert(it != fixed.end());
+                std::fill(columns[s].begin(), columns[s].end(), it->second);
             }
-            break;
-            case NodeType::Operator:
+            for (size_t block; next(block);)
             {
-                const double rhs = stack.back();
-                stack.pop_back();
-                const double lhs = stack.back();
-                stack.pop_back();
-                switch (t.str[0])
+                const size_t end = std::min(ny, (block + 1) * GridRowBlock);
+                for (size_t r = block * GridRowBlock; r < end; ++r)
                 {
-                case '^':
-                    stack.push_back(std::pow(lhs, rhs));
-                    break;
-                case '*':
-                    stack.push_back(lhs * rhs);
-                    break;
-                case '/':
-                    stack.push_back(lhs / rhs);
-
-                    break;
-                case '+':
-                    stack.push_back(lhs + rhs);
-                    break;
-                case '-':
-                    stack.push_back(lhs - rhs);
-                    break;
+                    if (y_slot < slots.size())
+                    {
+                        std::fill(columns[y_slot].begin(), columns[y_slot].end(), y0 + r * dy);
+                    }
+                    evaluateBatch(inputs.data(), out + r * nx, nx);
                 }
             }
-            break;
-            }
-        }
-        return stack.back();
+        });
     }
 
 private:
@@ -344,6 +351,154 @@ private:
     };
 
     std::vector<Token> output_stack;
+    std::vector<Instruction> program;
+    std::vector<char> slots;
+    size_t max_depth = 0;
+    [[no_unique_address]] mprof::ExpressionProbe probe;
+    std::shared_ptr<mtier::TierState> tiers = std::make_shared<mtier::TierState>();
+
+    // Runs a scalar call in the current tier on the slot values bind() fills:
+    // the stack program in the interpreter tier, otherwise the optimized one.
+    template <typename Bind>
+    double tiered(Bind bind) const
+    {
+        const uint64_t t0 = probe.begin();
+        mtier::TierState &state = *tiers;
+        const mtier::Tier tier = (mtier::Tier)state.scalar_tier.load(std::memory_order_acquire);
+        const uint64_t n = state.count(tier);
+        const bool timed = n % mtier::SampleEvery == 0;
+        const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        double values[MaxSlots];
+        bind(values);
+        double result;
+        if (tier == mtier::Tier::Interpreter)
+        {
+            result = evaluateCompiled(compiled(), values);
+            if (n + 1 >= mtier::policy().optimize_after.load(std::memory_order_relaxed) &&
+                state.request(mtier::Tier::Optimized))
+            {
+                mtier::promote(tiers, mtier::Tier::Optimized, program, mtier::policy().background.load());
+            }
+        }
+        else
+        {
+            result = state.optimized.load(std::memory_order_acquire)->evaluate(values);
+        }
+        if (timed)
+        {
+            state.addTime(tier, mtier::SampleEvery * std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        probe.end(t0);
+        return result;
+    }
+
+    static bool functionOpCode(const std::string &name, OpCode &op)
+    {
+        static const std::map<std::string, OpCode> functions = {
+            {"sin", OpCode::Sin},
+            {"asin", OpCode::Asin},
+            {"sinh", OpCode::Sinh},
+            {"cos", OpCode::Cos},
+            {"acos", OpCode::Acos},
+            {"cosh", OpCode::Cosh},
+            {"tan", OpCode::Tan},
+            {"atan", OpCode::Atan},
+            {"tanh", OpCode::Tanh},
+            {"log", OpCode::Log},
+            {"ln", OpCode::Ln},
+            {"sqrt", OpCode::Sqrt},
+            {"abs", OpCode::Abs}};
+        auto it = functions.find(name);
+        if (it == functions.end())
+        {
+            return false;
+        }
+        op = it->second;
+        return true;
+    }
+
+    // Lowers output_stack to program. A '+' or '-' meeting a single operand is
+    // unary; unknown functions leave their argument untouched. An operator or
+    // function with nothing to apply to throws std::invalid_argument.
+    void compile()
+    {
+        size_t depth = 0;
+        for (auto &t : output_stack)
+        {
+            Instruction ins;
+            switch (t.type)
+            {
+            case NodeType::Number:
+                ins.op = OpCode::Const;
+                ins.value = std::stod(t.str);
+                ++depth;
+                break;
+            case NodeType::Variable:
+            {
+                ins.op = OpCode::Load;
+                auto it = std::find(slots.begin(), slots.end(), t.str[0]);
+                ins.slot = it - slots.begin();
+                if (it == slots.end())
+                {
+                    assert(slots.size() < MaxSlots);
+                    slots.push_back(t.str[0]);
+                }
+                ++depth;
+            }
+            break;
+            case NodeType::Function:
+                if (depth == 0)
+                {
+                    throw std::invalid_argument("missing argument of " + t.str);
+                }
+                if (!functionOpCode(t.str, ins.op))
+                {
+                    continue;
+                }
+                break;
+            case NodeType::Operator:
+                if (depth == 0)
+                {
+                    throw std::invalid_argument("missing operand of " + t.str);
+                }
+                if (depth == 1)
+                {
+                    if (t.str[0] != '-')
+                    {
+                        continue;
+                    }
+                    ins.op = OpCode::Neg;
+                    break;
+                }
+                switch (t.str[0])
+                {
+                case '^':
+                    ins.op = OpCode::Pow;
+                    break;
+                case '*':
+                    ins.op = OpCode::Mul;
+                    break;
+                case '/':
+                    ins.op = OpCode::Div;
+                    break;
+                case '+':
+                    ins.op = OpCode::Add;
+                    break;
+                case '-':
+                    ins.op = OpCode::Sub;
+                    break;
+                default:
+                    continue;
+                }
+                --depth;
+                break;
+            default:
+                continue;
+            }
+            program.push_back(ins);
+            max_depth = std::max(max_depth, depth);
+        }
+    }
 
     Range readToken(ContantIt &it, int (*condition)(int))
     {
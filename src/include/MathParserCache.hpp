@@ -0,0 +1,257 @@
+#ifndef MATH_PARSER_CACHE_H
+#define MATH_PARSER_CACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cctype>
+#include <functional>
+
+#include "MathParser.hpp"
+
+namespace mcache
+{
+    inline int precedence(char op)
+    {
+        switch (op)
+        {
+        case '+':
+        case '-':
+            return 2;
+        case '*':
+        case '/':
+            return 3;
+        case '^':
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+    // Canonical form of an expression used as cache key: whitespace dropped,
+    // except for one space where it separates two tokens ("sin x", "2 3"),
+    // and parentheses removed where MathParser would build the very same RPN
+    // without them, e.g. "((x))", "sin((x+1))", "(a*b)+c" or "a^(b^c)".
+    // Parentheses that change the order of evaluation are always kept, even
+    // when the result would be mathematically equal ("a+(b+c)"), since the
+    // floating point rounding would not be.
+    inline std::string normalize(const std::string &raw)
+    {
+        auto isOperand = [](char c)
+        {
+            return std::isalnum((unsigned char)c) || c == '.';
+        };
+        std::string s;
+        bool space = false;
+        for (char c : raw)
+        {
+            if (std::isspace((unsigned char)c))
+            {
+                space = true;
+                continue;
+            }
+            if (space && !s.empty() && isOperand(s.back()) && isOperand(c))
+            {
+                s.push_back(' ');
+            }
+            space = false;
+            s.push_back(c);
+        }
+        const size_t n = s.size();
+        std::vector<size_t> match(n, n);
+        std::vector<size_t> open;
+        std::vector<std::pair<size_t, size_t>> pairs; // inner pairs first
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (s[i] == '(')
+            {
+                open.push_back(i);
+            }
+            else if (s[i] == ')' && !open.empty())
+            {
+                match[open.back()] = i;
+                match[i] = open.back();
+                pairs.push_back({open.back(), i});
+                open.pop_back();
+            }
+        }
+        if (!open.empty())
+        {
+            return s; // unbalanced: leave it to the parser
+        }
+        // lowest precedence among the operators a pair exposes once its own
+        // parentheses are gone (0: none, the content is a single operand)
+        std::vector<int> lowest(n, 0);
+        std::vector<bool> removed(n, false);
+        auto isOperator = [](char c)
+        {
+            return precedence(c) > 0;
+        };
+        for (auto [l, r] : pairs)
+        {
+            int p = 0;
+            // a function applied without parentheses ("sin x") takes everything
+            // up to the closing parenthesis: the pair is never redundant then
+            bool bare_call = false;
+            for (size_t i = l + 1; i < r; ++i)
+            {
+                if (s[i] == '(')
+                {
+                    if (removed[i] && lowest[i] > 0)
+                    {
+                        p = p == 0 ? lowest[i] : std::min(p, lowest[i]);
+                    }
+                    i = match[i];
+                }
+                else if (std::isalpha((unsigned char)s[i]))
+                {
+                    size_t end = i;
+                    while (end < r && std::isalpha((unsigned char)s[end]))
+                    {
+                        ++end;
+                    }
+                    bare_call = bare_call || (end - i > 1 && s[end] != '(');
+                    i = end - 1;
+                }
+                else if (isOperator(s[i]))
+                {
+                    p = p == 0 ? precedence(s[i]) : std::min(p, precedence(s[i]));
+                }
+            }
+            lowest[l] = p;
+            const char before = l > 0 ? s[l - 1] : '(';
+            const char after = r + 1 < n ? s[r + 1] : ')';
+            bool redundant;
+            if (isOperand(before) || before == ')' || isOperand(after) || after == '(')
+            {
+                redundant = false; // function call or juxtaposed operands
+            }
+            else if (bare_call)
+            {
+                redundant = false;
+            }
+            else if (p == 0)
+            {
+                redundant = true;
+            }
+            else
+            {
+                const int pl = before == '(' ? 0 : precedence(before);
+                const int pr = after == ')' ? 0 : precedence(after);
+                redundant = (pl < p || (pl == p && p == 4)) && (pr < p || (pr == p && p != 4));
+            }
+            removed[l] = removed[r] = redundant;
+        }
+        std::string out;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!removed[i])
+            {
+                out.push_back(s[i]);
+            }
+        }
+        return out;
+    }
+
+    // Thread-safe LRU cache of compiled expressions keyed by normalize(raw).
+    // Entries are split over independently locked shards by key hash; a miss
+    // parses raw outside the lock, so a slow parse never blocks other lookups.
+    class ExpressionCache
+    {
+    public:
+        struct Stats
+        {
+            size_t hits;
+            size_t misses;
+            size_t evictions;
+            size_t size;
+        };
+
+        explicit ExpressionCache(size_t capacity = 4096, size_t shard_count = 16)
+            : shards(std::max<size_t>(shard_count, 1)),
+              shard_capacity(std::max<size_t>((capacity + shards.size() - 1) / shards.size(), 1))
+        {
+        }
+
+        // Throws what MathParser throws for malformed input; nothing is cached then.
+        std::shared_ptr<const MathParser> get(const std::string &raw)
+        {
+            std::string key = normalize(raw);
+            Shard &shard = shards[std::hash<std::string>{}(key) % shards.size()];
+            {
+                std::lock_guard lock(shard.mutex);
+                auto it = shard.index.find(key);
+                if (it != shard.index.end())
+                {
+                    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                    ++hits;
+                    mprof::cacheHit();
+                    return it->second->second;
+                }
+            }
+            ++misses;
+            mprof::cacheMiss();
+            auto parsed = std::make_shared<const MathParser>(raw);
+            std::lock_guard lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end())
+            {
+                // another thread parsed it meanwhile: share its copy
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                return it->second->second;
+            }
+            shard.lru.emplace_front(key, parsed);
+            shard.index.emplace(std::move(key), shard.lru.begin());
+            while (shard.lru.size() > shard_capacity)
+            {
+                shard.index.erase(shard.lru.back().first);
+                shard.lru.pop_back();
+                ++evictions;
+                mprof::cacheEviction();
+            }
+            return parsed;
+        }
+
+        Stats stats()
+        {
+            size_t size = 0;
+            for (auto &shard : shards)
+            {
+                std::lock_guard lock(shard.mutex);
+                size += shard.lru.size();
+            }
+            return {hits.load(), misses.load(), evictions.load(), size};
+        }
+
+        void clear()
+        {
+            for (auto &shard : shards)
+            {
+                std::lock_guard lock(shard.mutex);
+                shard.index.clear();
+                shard.lru.clear();
+            }
+        }
+
+    private:
+        using Entry = std::pair<std::string, std::shared_ptr<const MathParser>>;
+        struct Shard
+        {
+            std::mutex mutex;
+            std::list<Entry> lru; // most recently used first
+            std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        };
+
+        std::vector<Shard> shards;
+        size_t shard_capacity;
+        std::atomic<size_t> hits{0};
+        std::atomic<size_t> misses{0};
+        std::atomic<size_t> evictions{0};
+    };
+}
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef MATH_PROFILE_H
+#define MATH_PROFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Opt-in hot path instrumentation, enabled by building with
+// -DMATHPARSER_PROFILE (`make profile`). Without the flag every probe below
+// is an empty inline function and ExpressionProbe an empty member, so the
+// instrumented code compiles to exactly what it was.
+//
+// With the flag, the process keeps
+//  - per opcode execution counts and cycle estimates of the compiled
+//    evaluators (one rdtsc pair per opcode per batch block or scalar call),
+//  - per expression evaluation counts, with one in SampleEvery scalar calls
+//    timed into a log2 cycle histogram for percentiles (an expression
+//    evaluated in a bundle gets an equal share of each fused pass),
+//  - parse and cache counters,
+// and mprof::dump writes them as text metrics. Setting MATHPARSER_PROFILE_DUMP
+// to a path (or "-" for stderr) also dumps them at exit.
+
+#ifdef MATHPARSER_PROFILE
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <ostream>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace mprof
+{
+    constexpr bool Enabled = true;
+    constexpr size_t OpCodeCount = 21;
+    constexpr size_t SampleEvery = 64;
+    // in MathParser::OpCode order
+    constexpr const char *OpNames[OpCodeCount] = {"const", "load", "neg", "add", "sub", "mul", "div",
+                                                  "pow", "sin", "asin", "sinh", "cos", "acos", "cosh",
+                                                  "tan", "atan", "tanh", "log", "ln", "sqrt", "abs"};
+
+    inline uint64_t cycles()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    using Counter = std::atomic<uint64_t>;
+
+    inline void add(Counter &c, uint64_t v)
+    {
+        c.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    struct ExpressionStats
+    {
+        Counter evaluations{0}; // points, scalar calls count one
+        Counter sampled{0};
+        Counter sampled_cycles{0};
+        Counter batch_cycles{0};
+        Counter histogram[64] = {};
+
+        // Upper bound, in cycles, of the q-quantile of the sampled calls.
+        uint64_t percentile(double q) const
+        {
+            const uint64_t total = sampled.load();
+            uint64_t seen = 0;
+            for (size_t b = 0; b < 64; ++b)
+            {
+                seen += histogram[b].load();
+                if (total > 0 && seen >= q * total)
+                {
+                    return uint64_t(2) << b;
+                }
+            }
+            return 0;
+        }
+    };
+
+    struct Registry
+    {
+        Counter op_count[OpCodeCount] = {};
+        Counter op_cycles[OpCodeCount] = {};
+        Counter parses{0};
+        Counter parse_cycles{0};
+        Counter cache_hits{0};
+        Counter cache_misses{0};
+        Counter cache_evictions{0};
+        std::mutex mutex;
+        std::map<std::string, std::shared_ptr<ExpressionStats>> expressions;
+
+        std::shared_ptr<ExpressionStats> expression(const std::string &source)
+        {
+            std::lock_guard lock(mutex);
+            auto &stats = expressions[source];
+            if (!stats)
+            {
+                stats = std::make_shared<ExpressionStats>();
+            }
+            return stats;
+        }
+    };
+
+    void dumpAtExit();
+
+    inline Registry &registry()
+    {
+        static Registry instance;
+        static const bool at_exit = std::atexit(dumpAtExit) == 0;
+        (void)at_exit;
+        return instance;
+    }
+
+    inline std::string quote(const std::string &s)
+    {
+        std::string out;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out.push_back('\\');
+            }
+            out.push_back(c);
+        }
+        return out;
+    }
+
+    inline void dump(std::ostream &os)
+    {
+        Registry &r = registry();
+        os << "mathparser_parse_total " << r.parses.load() << "\n"
+           << "mathparser_parse_cycles_total " << r.parse_cycles.load() << "\n"
+           << "mathparser_cache_hits_total " << r.cache_hits.load() << "\n"
+           << "mathparser_cache_misses_total " << r.cache_misses.load() << "\n"
+           << "mathparser_cache_evictions_total " << r.cache_evictions.load() << "\n";
+        for (size_t op = 0; op < OpCodeCount; ++op)
+        {
+            if (r.op_count[op].load() == 0)
+            {
+                continue;
+            }
+            os << "mathparser_opcode_executions_total{op=\"" << OpNames[op] << "\"} " << r.op_count[op].load() << "\n"
+               << "mathparser_opcode_cycles_total{op=\"" << OpNames[op] << "\"} " << r.op_cycles[op].load() << "\n";
+        }
+        std::lock_guard lock(r.mutex);
+        for (auto &[source, stats] : r.expressions)
+        {
+            const std::string label = "{expr=\"" + quote(source) + "\"";
+            os << "mathparser_expression_evaluations_total" << label << "} " << stats->evaluations.load() << "\n"
+               << "mathparser_expression_batch_cycles_total" << label << "} " << stats->batch_cycles.load() << "\n"
+               << "mathparser_expression_sampled_total" << label << "} " << stats->sampled.load() << "\n"
+               << "mathparser_expression_sampled_cycles_total" << label << "} " << stats->sampled_cycles.load() << "\n";
+            for (double q : {0.5, 0.9, 0.99})
+            {
+                os << "mathparser_expression_latency_cycles" << label << ",quantile=\"" << q << "\"} "
+                   << stats->percentile(q) << "\n";
+            }
+        }
+    }
+
+    inline void dumpAtExit()
+    {
+        const char *path = std::getenv("MATHPARSER_PROFILE_DUMP");
+        if (path == nullptr || *path == '\0')
+        {
+            return;
+        }
+        if (std::string(path) == "-")
+        {
+            dump(std::cerr);
+            return;
+        }
+        std::ofstream out(path);
+        dump(out);
+    }
+
+    // Per MathParser handle on its ExpressionStats.
+    struct ExpressionProbe
+    {
+        std::shared_ptr<ExpressionStats> stats;
+
+        void attach(const std::string &source)
+        {
+            stats = registry().expression(source);
+        }
+        // Returns the start time of a sampled call, 0 for the others.
+        uint64_t begin() const
+        {
+            if (!stats)
+            {
+                return 0;
+            }
+            const uint64_t n = stats->evaluations.fetch_add(1, std::memory_order_relaxed);
+            return n % SampleEvery == 0 ? cycles() : 0;
+        }
+        void end(uint64_t start) const
+        {
+            if (start == 0)
+            {
+                return;
+            }
+            const uint64_t elapsed = cycles() - start;
+            add(stats->sampled, 1);
+            add(stats->sampled_cycles, elapsed);
+            add(stats->histogram[elapsed > 1 ? 63 - __builtin_clzll(elapsed) : 0], 1);
+        }
+        uint64_t beginBatch() const
+        {
+            return stats ? cycles() : 0;
+        }
+        void endBatch(uint64_t start, size_t points) const
+        {
+            endShared(start, points, 1);
+        }
+        // For a pass evaluating shares expressions at once.
+        void endShared(uint64_t start, size_t points, size_t shares) const
+        {
+            if (stats)
+            {
+                add(stats->evaluations, points);
+                add(stats->batch_cycles, (cycles() - start) / shares);
+            }
+        }
+    };
+
+    inline uint64_t opBegin()
+    {
+        return cycles();
+    }
+    inline void opEnd(uint8_t op, size_t executions, uint64_t start)
+    {
+        Registry &r = registry();
+        add(r.op_count[op], executions);
+        add(r.op_cycles[op], cycles() - start);
+    }
+    inline uint64_t parseBegin()
+    {
+        return cycles();
+    }
+    inline void parseEnd(uint64_t start)
+    {
+        Registry &r = registry();
+        add(r.parses, 1);
+        add(r.parse_cycles, cycles() - start);
+    }
+    inline void cacheHit()
+    {
+        add(registry().cache_hits, 1);
+    }
+    inline void cacheMiss()
+    {
+        add(registry().cache_misses, 1);
+    }
+    inline void cacheEviction()
+    {
+        add(registry().cache_evictions, 1);
+    }
+}
+
+#else
+
+#include <ostream>
+
+namespace mprof
+{
+    constexpr bool Enabled = false;
+
+    struct ExpressionProbe
+    {
+        void attach(const std::string &) {}
+        uint64_t begin() const { return 0; }
+        void end(uint64_t) const {}
+        uint64_t beginBatch() const { return 0; }
+        void endBatch(uint64_t, size_t) const {}
+        void endShared(uint64_t, size_t, size_t) const {}
+    };
+
+    inline uint64_t opBegin() { return 0; }
+    inline void opEnd(uint8_t, size_t, uint64_t) {}
+    inline uint64_t parseBegin() { return 0; }
+    inline void parseEnd(uint64_t) {}
+    inline void cacheHit() {}
+    inline void cacheMiss() {}
+    inline void cacheEviction() {}
+    inline void dump(std::ostream &os)
+    {
+        os << "# built without MATHPARSER_PROFILE\n";
+    }
+}
+
+#endif
+
+#endif
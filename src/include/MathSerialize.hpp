@@ -0,0 +1,254 @@
+#ifndef MATH_SERIALIZE_H
+#define MATH_SERIALIZE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+#include "MathParser.hpp"
+#include "MathColumnIO.hpp"
+
+// Expression libraries: many compiled expressions in one versioned binary
+// file. A library is mapped and its records are used as
+// MathParser::CompiledView straight from the file pages, so loading costs a
+// checksum pass instead of tokenize + shuntingYard per formula.
+//
+// Layout, all little-endian and 8 byte aligned:
+//   LibraryHeader
+//   uint64_t offsets[count]            file offset of each record
+//   records: RecordHeader, Instruction code[length], char slots[slot_count],
+//            char source[source_length], zero padding to 8 bytes
+namespace mserial
+{
+    static_assert(sizeof(MathParser::Instruction) == 16 && offsetof(MathParser::Instruction, value) == 8,
+                  "Instruction is stored as is in libraries");
+
+    constexpr char Magic[4] = {'M', 'P', 'E', 'X'};
+    // Bump on any change to the layout or to MathParser::OpCode.
+    constexpr uint16_t Version = 1;
+
+    struct LibraryHeader
+    {
+        char magic[4]; // "MPEX"
+        uint16_t version;
+        uint16_t reserved;
+        uint32_t count;
+        uint32_t reserved1;
+        uint64_t size;     // of the whole file
+        uint64_t checksum; // FNV-1a of every byte after the header
+    };
+    static_assert(sizeof(LibraryHeader) == 32);
+
+    struct RecordHeader
+    {
+        uint32_t length;
+        uint32_t slot_count;
+        uint32_t max_depth;
+        uint32_t source_length;
+    };
+    static_assert(sizeof(RecordHeader) == 16);
+
+    inline uint64_t fnv1a(const char *data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    inline size_t align8(size_t n)
+    {
+        return (n + 7) & ~size_t(7);
+    }
+
+    // Builds the library image of the given sources, compiling each one.
+    inline std::vector<char> serialize(const std::vector<std::string> &sources)
+    {
+        std::vector<char> image(sizeof(LibraryHeader) + sources.size() * sizeof(uint64_t));
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            const uint64_t offset = image.size();
+            std::memcpy(image.data() + sizeof(LibraryHeader) + i * sizeof(uint64_t), &offset, sizeof(offset));
+
+            const MathParser parser(sources[i]);
+            MathParser::CompiledView expr = parser.compiled();
+            RecordHeader record{(uint32_t)expr.length, (uint32_t)expr.slot_count, (uint32_t)expr.max_depth,
+                                (uint32_t)sources[i].size()};
+            const size_t code_at = offset + sizeof(RecordHeader);
+            const size_t slots_at = code_at + expr.length * sizeof(MathParser::Instruction);
+            const size_t source_at = slots_at + expr.slot_count;
+            image.resize(align8(source_at + sources[i].size()), 0);
+            std::memcpy(image.data() + offset, &record, sizeof(record));
+            // field by field so that the padding bytes stay zero
+            for (size_t k = 0; k < expr.length; ++k)
+            {
+                char *dst = image.data() + code_at + k * sizeof(MathParser::Instruction);
+                dst[0] = expr.code[k].op;
+                dst[1] = expr.code[k].slot;
+                std::memcpy(dst + 8, &expr.code[k].value, sizeof(double));
+            }
+            std::memcpy(image.data() + slots_at, expr.slots, expr.slot_count);
+            std::memcpy(image.data() + source_at, sources[i].data(), sources[i].size());
+        }
+        LibraryHeader header{};
+        std::memcpy(header.magic, Magic, 4);
+        header.version = Version;
+        header.count = sources.size();
+        header.size = image.size();
+        header.checksum = fnv1a(image.data() + sizeof(LibraryHeader), image.size() - sizeof(LibraryHeader));
+        std::memcpy(image.data(), &header, sizeof(header));
+        return image;
+    }
+
+    inline void writeLibrary(const std::string &path, const std::vector<std::string> &sources)
+    {
+        std::vector<char> image = serialize(sources);
+        mcolumn::MappedFile file(path, image.size());
+        std::memcpy(file.data(), image.data(), image.size());
+    }
+
+    // Read-only view over a library image. Nothing is copied: operator[]
+    // returns views into the image, which must outlive them.
+    class LibraryView
+    {
+    public:
+        LibraryView() = default;
+        // Checks the header, the checksum and that every record is well formed
+        // (in bounds, known opcodes, slots and stack depth consistent), so the
+        // evaluator never runs off a corrupt file.
+        LibraryView(const char *data, size_t size)
+            : data(data)
+        {
+            if (size < sizeof(LibraryHeader) || std::memcmp(data, Magic, 4) != 0)
+            {
+                throw std::runtime_error("not an expression library");
+            }
+            std::memcpy(&header, data, sizeof(header));
+            if (header.version != Version)
+            {
+                throw std::runtime_error("unsupported expression library version " + std::to_string(header.version));
+            }
+            if (header.size != size || header.count > (size - sizeof(LibraryHeader)) / sizeof(uint64_t))
+            {
+                throw std::runtime_error("truncated expression library");
+            }
+            if (fnv1a(data + sizeof(LibraryHeader), size - sizeof(LibraryHeader)) != header.checksum)
+            {
+                throw std::runtime_error("expression library checksum mismatch");
+            }
+            for (size_t i = 0; i < header.count; ++i)
+            {
+                validate(i, size);
+            }
+        }
+        size_t size() const
+        {
+            return header.count;
+        }
+        MathParser::CompiledView operator[](size_t i) const
+        {
+            const char *record = data + offset(i);
+            const RecordHeader *r = (const RecordHeader *)record;
+            const char *code = record + sizeof(RecordHeader);
+            return {(const MathParser::Instruction *)code, r->length,
+                    code + r->length * sizeof(MathParser::Instruction), r->slot_count, r->max_depth};
+        }
+        std::string_view source(size_t i) const
+        {
+            MathParser::CompiledView expr = (*this)[i];
+            const RecordHeader *r = (const RecordHeader *)(data + offset(i));
+            return {expr.slots + expr.slot_count, r->source_length};
+        }
+
+    private:
+        uint64_t offset(size_t i) const
+        {
+            uint64_t at;
+            std::memcpy(&at, data + sizeof(LibraryHeader) + i * sizeof(uint64_t), sizeof(at));
+            return at;
+        }
+        void validate(size_t i, size_t size) const
+        {
+            // sizes are checked against what is left past at, so a crafted
+            // offset cannot wrap around
+            const uint64_t at = offset(i);
+            if (at % 8 != 0 || at > size || size - at < sizeof(RecordHeader))
+            {
+                throw std::runtime_error("corrupt expression library record " + std::to_string(i));
+            }
+            const RecordHeader *r = (const RecordHeader *)(data + at);
+            const uint64_t body = uint64_t(r->length) * sizeof(MathParser::Instruction) + r->slot_count + r->source_length;
+            if (body > size - at - sizeof(RecordHeader))
+            {
+                throw std::runtime_error("corrupt expression library record " + std::to_string(i));
+            }
+            MathParser::CompiledView expr = (*this)[i];
+            size_t depth = 0;
+            size_t max_depth = 0;
+            for (size_t k = 0; k < expr.length; ++k)
+            {
+                const MathParser::Instruction &ins = expr.code[k];
+                bool ok = ins.op <= MathParser::OpCode::Abs;
+                if (ins.op == MathParser::OpCode::Const || ins.op == MathParser::OpCode::Load)
+                {
+                    ok = ok && (ins.op == MathParser::OpCode::Const || ins.slot < expr.slot_count);
+                    max_depth = std::max(max_depth, ++depth);
+                }
+                else if (ins.op >= MathParser::OpCode::Add && ins.op <= MathParser::OpCode::Pow)
+                {
+                    ok = ok && depth >= 2;
+                    --depth;
+                }
+                else
+                {
+                    ok = ok && depth >= 1;
+                }
+                if (!ok)
+                {
+                    throw std::runtime_error("corrupt expression library record " + std::to_string(i));
+                }
+            }
+            if (max_depth != expr.max_depth)
+            {
+                throw std::runtime_error("corrupt expression library record " + std::to_string(i));
+            }
+        }
+
+        const char *data = nullptr;
+        LibraryHeader header{};
+    };
+
+    // A library file mapped read-only and evaluated in place.
+    class Library
+    {
+    public:
+        explicit Library(const std::string &path)
+            : file(path), view(file.data(), file.size())
+        {
+        }
+        size_t size() const
+        {
+            return view.size();
+        }
+        MathParser::CompiledView operator[](size_t i) const
+        {
+            return view[i];
+        }
+        std::string_view source(size_t i) const
+        {
+            return view.source(i);
+        }
+
+    private:
+        mcolumn::MappedFile file;
+        LibraryView view;
+    };
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef MATH_TIERS_H
+#define MATH_TIERS_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <chrono>
+
+#include "MathOptimizer.hpp"
+
+// Tiered execution of MathParser. Every expression starts in the
+// Interpreter tier, which is what the constructor builds: the stack program,
+// for scalar calls and batches alike. Evaluations are
+// counted per tier and, past a threshold, the register program of
+// moptimize (constants folded, common subexpressions shared, registers
+// allocated) is built in the background:
+//  - Optimized: scalar calls run it, after policy().optimize_after calls;
+//  - Vectorized: batch calls run it block by block, after
+//    policy().vectorize_after points.
+// Programs are published with a single atomic store and never freed before
+// the expression, so callers already running keep the program they loaded.
+// There is no native code tier: the block evaluator is the fastest backend.
+namespace mtier
+{
+    enum Tier : uint8_t
+    {
+        Interpreter,
+        Optimized,
+        Vectorized
+    };
+    constexpr size_t TierCount = 3;
+    // One scalar call in SampleEvery is timed, its time scaled by SampleEvery.
+    constexpr uint64_t SampleEvery = 64;
+
+    inline const char *tierName(Tier tier)
+    {
+        switch (tier)
+        {
+        case Tier::Interpreter:
+            return "interpreter";
+        case Tier::Optimized:
+            return "optimized";
+        default:
+            return "vectorized";
+        }
+    }
+
+    struct Policy
+    {
+        std::atomic<uint64_t> optimize_after{256};      // scalar calls
+        std::atomic<uint64_t> vectorize_after{1 << 16}; // batch points
+        std::atomic<bool> background{true};             // false: promote in the calling thread
+    };
+
+    inline Policy &policy()
+    {
+        static Policy instance;
+        return instance;
+    }
+
+    struct Promotion
+    {
+        Tier to;
+        uint64_t at_evaluations; // over all tiers, when the build finished
+        double build_seconds;
+    };
+
+    struct Stats
+    {
+        Tier scalar_tier;
+        Tier batch_tier;
+        uint64_t evaluations[TierCount]; // scalar calls plus batch points
+        double seconds[TierCount];       // estimated for scalar calls
+        std::vector<Promotion> promotions;
+    };
+
+    // Single background thread building promoted programs.
+    class Promoter
+    {
+    public:
+        static Promoter &instance()
+        {
+            static Promoter promoter;
+            return promoter;
+        }
+        void submit(std::function<void()> job)
+        {
+            std::lock_guard lock(mutex);
+            if (!worker.joinable())
+            {
+                worker = std::thread([this]
+                                     { loop(); });
+            }
+            jobs.push_back(std::move(job));
+            wake.notify_one();
+        }
+        ~Promoter()
+        {
+            {
+                std::lock_guard lock(mutex);
+                stop = true;
+                wake.notify_one();
+            }
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+
+    private:
+        void loop()
+        {
+            std::unique_lock lock(mutex);
+            while (true)
+            {
+                wake.wait(lock, [&]
+                          { return stop || !jobs.empty(); });
+                if (jobs.empty())
+                {
+                    return;
+                }
+                std::function<void()> job = std::move(jobs.front());
+                jobs.pop_front();
+                lock.unlock();
+                job();
+                lock.lock();
+            }
+        }
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<std::function<void()>> jobs;
+        bool stop = false;
+        std::thread worker;
+    };
+
+    // Shared by a MathParser and its copies, and kept alive by pending
+    // promotion jobs so a parser may die while its program is being built.
+    struct TierState
+    {
+        std::atomic<uint8_t> scalar_tier{Tier::Interpreter};
+        std::atomic<uint8_t> batch_tier{Tier::Interpreter};
+        std::atomic<const moptimize::RegisterProgram *> optimized{nullptr};
+        std::atomic<const moptimize::RegisterProgram *> vectorized{nullptr};
+        std::atomic<bool> requested[TierCount] = {};
+        std::atomic<uint64_t> evaluations[TierCount] = {};
+        std::atomic<uint64_t> nanoseconds[TierCount] = {};
+
+        std::mutex mutex; // guards what follows
+        std::condition_variable installed;
+        std::shared_ptr<const moptimize::RegisterProgram> owners[TierCount];
+        std::vector<Promotion> promotions;
+
+        uint64_t count(Tier tier, uint64_t n = 1)
+        {
+            return evaluations[tier].fetch_add(n, std::memory_order_relaxed);
+        }
+        void addTime(Tier tier, uint64_t ns)
+        {
+            nanoseconds[tier].fetch_add(ns, std::memory_order_relaxed);
+        }
+        // True for the one caller that gets to start the promotion to tier.
+        bool request(Tier tier)
+        {
+            return !requested[tier].exchange(true, std::memory_order_relaxed);
+        }
+        void install(Tier tier, std::shared_ptr<const moptimize::RegisterProgram> program, double build_seconds)
+        {
+            std::lock_guard lock(mutex);
+            owners[tier] = program;
+            uint64_t total = 0;
+            for (auto &e : evaluations)
+            {
+                total += e.load(std::memory_order_relaxed);
+            }
+            promotions.push_back({tier, total, build_seconds});
+            if (tier == Tier::Optimized)
+            {
+                optimized.store(program.get(), std::memory_order_release);
+                scalar_tier.store(tier, std::memory_order_release);
+            }
+            else
+            {
+                vectorized.store(program.get(), std::memory_order_release);
+                batch_tier.store(tier, std::memory_order_release);
+            }
+            installed.notify_all();
+        }
+        // Blocks until the program of tier is installed.
+        void waitFor(Tier tier)
+        {
+            std::unique_lock lock(mutex);
+            installed.wait(lock, [&]
+                           { return (tier == Tier::Optimized ? scalar_tier : batch_tier).load() == tier; });
+        }
+        Stats stats()
+        {
+            Stats s;
+            s.scalar_tier = (Tier)scalar_tier.load();
+            s.batch_tier = (Tier)batch_tier.load();
+            for (size_t t = 0; t < TierCount; ++t)
+            {
+                s.evaluations[t] = evaluations[t].load();
+                s.seconds[t] = nanoseconds[t].load() * 1e-9;
+            }
+            std::lock_guard lock(mutex);
+            s.promotions = promotions;
+            return s;
+        }
+    };
+
+    // Builds the program of tier from a copy of the stack program, on the
+    // Promoter thread or, without background, in the calling one.
+    inline void promote(const std::shared_ptr<TierState> &state, Tier tier, std::vector<mbytecode::Instruction> code,
+                        bool background)
+    {
+        auto job = [state, tier, code = std::move(code)]()
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto program = std::make_shared<const moptimize::RegisterProgram>(
+                moptimize::optimize(code.data(), code.size()));
+            state->install(tier, program, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        };
+        if (background)
+        {
+            Promoter::instance().submit(std::move(job));
+        }
+        else
+        {
+            job();
+        }
+    }
+}
+
+#endif
@@ -1,27 +1,102 @@
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <algorithm>
 #include <ncurses.h>
 
 #include "MathParser.hpp"
 #include "MathFunctionGraphConsole.hpp"
+#include "MathContour.hpp"
+#include "MathBatch.hpp"
+#include "MathColumnIO.hpp"
+#include "MathParserCache.hpp"
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && (std::string(argv[1]) == "--batch" || std::string(argv[1]) == "--columns"))
+    {
+        try
+        {
+            if (std::string(argv[1]) == "--columns")
+            {
+                return mcolumn::main(argc - 2, argv + 2);
+            }
+            return mbatch::main(argc - 2, argv + 2);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[X] " << e.what() << std::endl;
+            return 1;
+        }
+    }
     VectorState *pointer = nullptr;
     double unit;
+    mcache::ExpressionCache cache(64);
+    std::string error;
     while (true)
     {
         system("clear"); //TODO cross platform
+        if (!error.empty())
+        {
+            std::cout << "[X] Invalid f(x): " << error << "\n";
+            error.clear();
+        }
 
         std::cout << "\033[106m\033[97m Insert a f(x) : \033[39m\033[49m" << std::endl;
         std::string raw;
-        std::cin >> raw;
-        MathParser expression(raw);
+        std::getline(std::cin >> std::ws, raw);
+        std::shared_ptr<const MathParser> expression;
+        try
+        {
+            expression = cache.get(raw);
+        }
+        catch (const std::invalid_argument &e)
+        {
+            error = e.what();
+            continue;
+        }
         auto f = [&](double x)
         {
-            return expression.evaluateFunctionInX(x);
+            return expression->evaluateFunctionInX(x);
         };
-        if (pointer == nullptr)
+        const std::vector<char> &vars = expression->variables();
+        if (std::find(vars.begin(), vars.end(), 'y') != vars.end())
+        {
+            // f(x,y): sample a square grid around the origin and show it as a
+            // heatmap with the curve f(x,y) = 0 on top
+            std::map<std::string, double> fixed;
+            for (char v : vars)
+            {
+                if (v == 'x' || v == 'y')
+                {
+                    continue;
+                }
+                std::cout << "\033[41m\033[97m Insert a value for " << v << " : \033[39m\033[49m" << std::endl;
+                double value;
+                while (!(std::cin >> value))
+                {
+                    std::cin.clear();
+                    std::cin.ignore(2147483647, '\n');
+                    std::cout << "[X] Invalid input: pls provide a decimal number...\n";
+                }
+                fixed[std::string{v}] = value;
+            }
+            std::cout << "\033[41m\033[97m Insert a unit : \033[39m\033[49m" << std::endl;
+            while (!(std::cin >> unit))
+            {
+                std::cin.clear();
+                std::cin.ignore(2147483647, '\n');
+                std::cout << "[X] Invalid input: pls provide a decimal number...\n";
+            }
+            const int width = 25;
+            const double half = (width / 2) * unit;
+            std::vector<double> grid(width * width);
+            expression->evaluateGrid(-half, half, width, -half, half, width, grid.data(), fixed);
+            const std::vector<mcontour::Segment> zero = mcontour::marchingSquares(grid.data(), width, width,
+                                                                                  -half, half, -half, half, 0.0);
+            mfgc::heatmap(grid.data(), width, width, mcontour::rasterize(zero, width, width, -half, half, -half, half));
+        }
+        else if (pointer == nullptr)
         {
             std::cout << "\033[41m\033[97m Insert a unit : \033[39m\033[49m" << std::endl;
             while (!(std::cin >> unit))